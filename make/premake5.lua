@@ -7,7 +7,7 @@ solution "emulators"
 	language "C++"
 	system "Windows"
 	architecture "x64"
-	configurations { "Debug", "Release" }
+	configurations { "Debug", "Release", "ReleaseHeadless" }
 	location("../_prj/" .. _ACTION)
     debugdir "../data"
     characterset "MBCS"
@@ -31,6 +31,10 @@ solution "emulators"
 		defines { "NDEBUG" }
 		optimize "full"
 
+	-- headless runs. breakpoint checks compiled out of the cpu
+	configuration "ReleaseHeadless"
+		defines { "CPU_NO_DEBUGGER" }
+
 	-- Projects
 	project("emulators")
 		location("../_prj/" .. _ACTION)
@@ -8,4 +8,7 @@ mkdir ..\_test_results
 pip install argparse junit_xml --user
 python run_unittest.py --emulator ..\_build\Release\emulators\emulators.exe --unit_test_filename ..\data\gameboy\unit_test.json --results_dir ..\_test_results
 
+REM the same tests with hot blocks translated to native code
+python run_unittest.py --emulator ..\_build\Release\emulators\emulators.exe --unit_test_filename ..\data\gameboy\unit_test.json --results_dir ..\_test_results\jit --jit
+
 popd
\ No newline at end of file
@@ -15,6 +15,7 @@ if __name__ == "__main__":
 	parser.add_argument('--emulator', required=True, help='The emulator executable to run the unit test')
 	parser.add_argument('--unit_test_filename', required=True, help='Unit test filename')
 	parser.add_argument('--results_dir', required=True, help='Unit test results output directory')
+	parser.add_argument('--jit', action='store_true', help='Run the emulator with the jit enabled')
 
 	args = parser.parse_args()
 
@@ -37,10 +38,16 @@ if __name__ == "__main__":
 			print('Running unit test: %s' % (test['filename']))
 
 			rom_filename = os.path.join(base_path, test['filename'])
-			test_name = os.path.split(rom_filename)[1].split('.')[0]
+			test_name = test.get('name', os.path.split(rom_filename)[1].split('.')[0])
 			start_time = time.time()
 
-			cmd = '"%s" -u -p %s -c "%s" -r %s' % (emulator_exe, test['abort_pc'], test['checksum'], rom_filename)
+			# tests with their own args run a test mode against the rom instead of checking its output
+			if 'args' in test:
+				cmd = '"%s" %s -r %s' % (emulator_exe, test['args'], rom_filename)
+			else:
+				cmd = '"%s" -u -p %s -c "%s" -r %s' % (emulator_exe, test['abort_pc'], test['checksum'], rom_filename)
+			if args.jit:
+				cmd += ' -j'
 			ret = subprocess.run(cmd)
 
 			# generate test case
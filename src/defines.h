@@ -20,16 +20,18 @@
 #include <iomanip>
 #include <fstream>
 #include <iterator>
+#include <array>
+#include <utility>
 
 typedef unsigned char u8;
 typedef unsigned short u16;
 typedef unsigned int u32;
-typedef unsigned long u64;
+typedef unsigned long long u64;
 
 typedef char s8;
 typedef short s16;
 typedef int s32;
-typedef long s64;
+typedef long long s64;
 
 #define warning(x)					__pragma(message("[warning] - " x));
 #define warning_assert(x)			warning(x); assert(0); 
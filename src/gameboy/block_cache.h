@@ -0,0 +1,214 @@
+#pragma once
+
+#include "defines.h"
+
+#include "memory_module.h"
+
+namespace gameboy
+{
+	namespace block_cache
+	{
+		const u8 max_block_ops = 32;
+
+		// translated block. same arguments and result as cpu::execute_block
+		typedef int(*jit_function)(s32 max_cycles, u16* opcode_pc, s32 stop_pc);
+
+		// one pre-decoded instruction. the handler runs with pc already past the opcode bytes
+		struct block_op
+		{
+			int(*handler)();
+			u8 opcode_length; // 1, or 2 for cb prefixed
+			u8 length; // opcode and operand bytes
+		};
+
+		// straight run of instructions up to and including the next branch
+		struct block
+		{
+			u16 addr_start;
+			u16 addr_end; // last byte of the last instruction
+			u32 cycles; // sum of the longest timing of every op
+			u8 op_count;
+			bool jit_allowed; // rom code not touching the io registers
+			u32 run_count;
+			jit_function jit_code;
+			block_op ops[max_block_ops];
+		};
+
+		// blocks are looked up by pc. rom bank 0 and the switchable bank keep a table per rom bank. table 0 is the fixed
+		// bank and switchable bank n uses table n + 1, as mbc5 can map bank 0 into the switchable bank too
+		std::vector<block**> rom_bank_blocks;
+		block** switchable_rom_blocks = nullptr;
+		u8* switchable_rom_ptr = nullptr; // mapped bank the switchable table was looked up for
+		block* working_ram_blocks[0x2000];
+		block* zero_page_blocks[0x80];
+		std::vector<block*> page_blocks[0x100]; // ram blocks by the 256 byte pages they cover
+		u32 flush_count = 0;
+
+		block** get_rom_bank_blocks(u32 bank)
+		{
+			if (bank >= rom_bank_blocks.size())
+			{
+				rom_bank_blocks.resize(bank + 1, nullptr);
+			}
+
+			if (rom_bank_blocks[bank] == nullptr)
+			{
+				rom_bank_blocks[bank] = new block*[0x4000]();
+			}
+
+			return rom_bank_blocks[bank];
+		}
+
+		// slot for the block starting at addr. null if code at addr is not cached
+		block** get_block_slot(u16 addr)
+		{
+			if (addr < 0x4000)
+			{
+				return &get_rom_bank_blocks(0)[addr];
+			}
+			else if (addr < 0x8000)
+			{
+				if (mbc::memory_switchable_rom != switchable_rom_ptr)
+				{
+					switchable_rom_ptr = mbc::memory_switchable_rom;
+					switchable_rom_blocks = get_rom_bank_blocks(mbc::controller->get_rom_bank_idx() + 1);
+				}
+
+				return &switchable_rom_blocks[addr - 0x4000];
+			}
+			else if (addr >= 0xC000 && addr < 0xE000)
+			{
+				return &working_ram_blocks[addr - 0xC000];
+			}
+			else if (addr >= 0xFF80 && addr < 0xFFFF)
+			{
+				return &zero_page_blocks[addr - 0xFF80];
+			}
+
+			return nullptr;
+		}
+
+		// last address a block starting at addr may cover. blocks do not cross a memory map or rom bank
+		u16 get_block_limit(u16 addr)
+		{
+			if (addr < 0x4000)
+			{
+				return 0x3FFF;
+			}
+			else if (addr < 0x8000)
+			{
+				return 0x7FFF;
+			}
+			else if (addr < 0xE000)
+			{
+				return 0xDFFF;
+			}
+
+			return 0xFFFE;
+		}
+
+		void add_block(block** slot, block* new_block)
+		{
+			*slot = new_block;
+
+			// writes to ram holding code take the slow path so the block gets dropped
+			if (new_block->addr_start >= 0x8000)
+			{
+				for (u32 page = (new_block->addr_start >> 8); page <= (u32)(new_block->addr_end >> 8); page++)
+				{
+					page_blocks[page].push_back(new_block);
+					memory_module::protect_code_page((u8)page);
+				}
+			}
+		}
+
+		void remove_block(block* ram_block)
+		{
+			for (u32 page = (ram_block->addr_start >> 8); page <= (u32)(ram_block->addr_end >> 8); page++)
+			{
+				std::vector<block*>& blocks = page_blocks[page];
+				for (u32 i = 0; i < blocks.size(); i++)
+				{
+					if (blocks[i] == ram_block)
+					{
+						blocks[i] = blocks.back();
+						blocks.pop_back();
+						break;
+					}
+				}
+			}
+
+			*get_block_slot(ram_block->addr_start) = nullptr;
+			delete ram_block;
+		}
+
+		// drop the ram blocks overlapping addr_min - addr_max, which are on one page. returns the number dropped
+		u32 invalidate(u16 addr_min, u16 addr_max)
+		{
+			std::vector<block*>& blocks = page_blocks[addr_min >> 8];
+			u32 count = 0;
+
+			for (u32 i = 0; i < blocks.size();)
+			{
+				block* ram_block = blocks[i];
+				if (ram_block->addr_start <= addr_max && ram_block->addr_end >= addr_min)
+				{
+					remove_block(ram_block); // moves the last block into slot i
+					count++;
+				}
+				else
+				{
+					i++;
+				}
+			}
+
+			return count;
+		}
+
+		void invalidate_page(u8 page)
+		{
+			// drop every ram block overlapping the page
+			invalidate(page << 8, (page << 8) | 0xFF);
+		}
+
+		void flush()
+		{
+			flush_count++;
+
+			for (u32 bank = 0; bank < rom_bank_blocks.size(); bank++)
+			{
+				block** blocks = rom_bank_blocks[bank];
+				if (blocks)
+				{
+					for (u32 i = 0; i < 0x4000; i++)
+					{
+						delete blocks[i];
+					}
+
+					delete[] blocks;
+				}
+			}
+
+			rom_bank_blocks.clear();
+			switchable_rom_blocks = nullptr;
+			switchable_rom_ptr = nullptr;
+
+			for (u32 i = 0; i < 0x2000; i++)
+			{
+				delete working_ram_blocks[i];
+				working_ram_blocks[i] = nullptr;
+			}
+
+			for (u32 i = 0; i < 0x80; i++)
+			{
+				delete zero_page_blocks[i];
+				zero_page_blocks[i] = nullptr;
+			}
+
+			for (u32 i = 0; i < 0x100; i++)
+			{
+				page_blocks[i].clear();
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -4,6 +4,9 @@
 
 #include "memory_module.h"
 #include "input.h"
+#include "scheduler.h"
+#include "block_cache.h"
+#include "jit.h"
 
 //Opcode  Z80				GMB
 //---------------------------------------------
@@ -35,14 +38,20 @@
 //FD      <IY>				-						done
 //CB3X    SLL  r / (HL)		SWAP r / (HL)			done
 
+// use the runtime switch decoder instead of the per opcode handler tables. useful to compare correctness and speed of the two
+//#define CPU_REFERENCE_DECODER
+
+// compile out breakpoint and memory breakpoint checks. for headless runs
+//#define CPU_NO_DEBUGGER
+
+// execute every instruction through execute_opcode instead of the cached blocks
+//#define CPU_NO_BLOCK_CACHE
+
+// alu and rotate ops record their result and F is only computed when an instruction reads it
+//#define CPU_LAZY_FLAGS
+
 namespace gameboy
 {
-	namespace gpu
-	{
-		int update(u8 cycles);
-		void check_coincidence_flag();
-	}
-
 	namespace cpu
 	{
 		const u32 cycles_per_sec = 4194304;
@@ -53,31 +62,45 @@ namespace gameboy
 		bool halt = false;
 		bool halt_bug = false;
 		bool halt_continue_exec = false;
+		bool stop = false;
 		bool paused = false;
 
+		// breakpoint lists are for the debugger. checks use the 64k bit bitmaps
 		std::vector<u16> breakpoints;
 		std::vector<u16> soft_breakpoints;
 		std::vector<u16> memory_breakpoints;
+		u64 breakpoint_bitmap[0x10000 / 64];
+		u64 soft_breakpoint_bitmap[0x10000 / 64];
+		u64 memory_breakpoint_bitmap[0x10000 / 64];
 		bool breakpoint_hit;
 		bool breakpoint_disable_one_instr;
 		s32 memory_breakpoint_last_addr;
 
+#ifdef CPU_NO_DEBUGGER
+		const bool debug_hooks_armed = false;
+#else
+		bool debug_hooks_armed = false; // any breakpoint, soft breakpoint or memory breakpoint set
+#endif
+
 		bool interrupt_master;
 		u8* interrupt_enable_flag;
 		u8* interrupt_request_flag;
 
-		u8* timer_value;
+		// the divider and timer registers are worked out from the cycle counter when read. the timer only runs an
+		// event when it overflows
+		u8* timer_value; // timer as of the tick before timer_tick_cycles
 		u8* timer_controller;
 		u8* timer_modulator;
 		s32 timer_counter;
+		u64 timer_tick_cycles = scheduler::event_none; // next tick while the timer runs
 
 		u8* divide_value;
-		s32 divide_counter;
+		u8 divide_offset = 0; // the divider ticks every 256 cycles from reset. a write sets it to 0 without moving the ticks
 		
 		// debug instruction timings
 		static const int instruction_times_nocondition[] = {
 			1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1,
-			0, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,
+			1, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,
 			2, 3, 2, 2, 1, 1, 2, 1, 2, 2, 2, 2, 1, 1, 2, 1,
 			2, 3, 2, 2, 3, 3, 3, 1, 2, 2, 2, 2, 1, 1, 2, 1,
 			1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
@@ -96,7 +119,7 @@ namespace gameboy
 
 		static const int instruction_times_condition[] = {
 			1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1,
-			0, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,
+			1, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,
 			3, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,
 			3, 3, 2, 2, 3, 3, 3, 1, 3, 2, 2, 2, 1, 1, 2, 1,
 			1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
@@ -188,10 +211,67 @@ namespace gameboy
 			u16 pc;
 		} R;
 
-		// register pointers used by decoder
-		u16* register_pairs[] = { &R.bc, &R.de, &R.hl, &R.sp };
-		u16* register_pairs2[] = { &R.bc, &R.de, &R.hl, &R.af };
-		u8* register_single[] = { &R.b, &R.c, &R.d, &R.e, &R.h, &R.l, 0, &R.a };
+		// register accessors used by decoder. when the index is a compile time constant these fold to the register itself
+		inline u8& reg8(u8 idx)
+		{
+			switch (idx)
+			{
+			case 0x0: return R.b;
+			case 0x1: return R.c;
+			case 0x2: return R.d;
+			case 0x3: return R.e;
+			case 0x4: return R.h;
+			case 0x5: return R.l;
+			default: return R.a;
+			}
+		}
+
+		// register_single[idx] operand. (HL) goes through the memory module so io and mbc accesses have their side effects
+		inline u8 read_reg8(u8 idx)
+		{
+			if (idx == 0x6)
+			{
+				return memory_module::read_memory(R.hl);
+			}
+
+			return reg8(idx);
+		}
+
+		inline void write_reg8(u8 idx, u8 value)
+		{
+			if (idx == 0x6)
+			{
+				memory_module::write_memory(R.hl, value);
+			}
+			else
+			{
+				reg8(idx) = value;
+			}
+		}
+
+		inline u16& reg16(u8 idx)
+		{
+			switch (idx)
+			{
+			case 0x0: return R.bc;
+			case 0x1: return R.de;
+			case 0x2: return R.hl;
+			default: return R.sp;
+			}
+		}
+
+		inline u16& reg16_af(u8 idx);
+
+		inline u16& reg16_af_impl(u8 idx)
+		{
+			switch (idx)
+			{
+			case 0x0: return R.bc;
+			case 0x1: return R.de;
+			case 0x2: return R.hl;
+			default: return R.af;
+			}
+		}
 		
 		// stack functions
 		inline void push_sp_to_stack(u16 addr)
@@ -212,26 +292,76 @@ namespace gameboy
 			return (high << 8) | low;
 		}
 
+		// flags of the last alu or rotate op. bit 8 of the result is the carry and the half carry is bit 4 of half ^ result
+		u16 lazy_flags_result = 0;
+		u8 lazy_flags_half = 0;
+		u8 lazy_flags_subtraction = 0;
+		bool lazy_flags_pending = false;
+
+		inline u8 compute_flags(u16 result, u8 half, u8 subtraction)
+		{
+			return ((result & 0xFF) == 0 ? 0x80 : 0x0) | subtraction | (((half ^ result) & 0x10) << 1) | ((result >> 4) & 0x10);
+		}
+
+		// write the recorded flags to F. every direct read or partial update of F has to come after this
+		inline void materialize_flags()
+		{
+#ifdef CPU_LAZY_FLAGS
+			if (lazy_flags_pending)
+			{
+				R.f = compute_flags(lazy_flags_result, lazy_flags_half, lazy_flags_subtraction);
+				lazy_flags_pending = false;
+			}
+#endif
+		}
+
+		// result half is a ^ b for add and sub. the result itself gives no half carry
+		inline void set_result_flags(u16 result, u8 half, u8 subtraction)
+		{
+#ifdef CPU_LAZY_FLAGS
+			lazy_flags_result = result;
+			lazy_flags_half = half;
+			lazy_flags_subtraction = subtraction;
+			lazy_flags_pending = true;
+#else
+			R.f = compute_flags(result, half, subtraction);
+#endif
+		}
+
+		inline u16& reg16_af(u8 idx)
+		{
+			if (idx == 0x3)
+			{
+				materialize_flags();
+			}
+
+			return reg16_af_impl(idx);
+		}
+
 		// set and get flag helpers
 		inline void set_flag(u8 flag)
 		{
+			materialize_flags();
 			flag = (1 << flag);
 			R.f |= flag;
 		}
 
 		inline void clear_flag(u8 flag)
 		{
+			materialize_flags();
 			flag = (1 << flag);
 			R.f &= ~flag; // clear the bit
 		}
 
 		inline u8 get_flag(u8 flag)
 		{
+			materialize_flags();
 			return ((R.f & (1 << flag)) >> flag);
 		}
 
 		inline void clear_all_flags()
 		{
+			lazy_flags_pending = false;
 			R.f = 0x0;
 		}
 
@@ -244,24 +374,37 @@ namespace gameboy
 		};
 
 		// condition functions for instructions
-		inline bool condition_notzero()
+		// conditions read a recorded result directly
+		inline bool condition_zero()
 		{
-			return get_flag(FLAG_ZERO) == 0;
+#ifdef CPU_LAZY_FLAGS
+			if (lazy_flags_pending)
+			{
+				return (lazy_flags_result & 0xFF) == 0;
+			}
+#endif
+			return (R.f & 0x80) != 0;
 		}
 
-		inline bool condition_zero()
+		inline bool condition_notzero()
 		{
-			return get_flag(FLAG_ZERO) != 0;
+			return !condition_zero();
 		}
 
-		inline bool condition_notcarry()
+		inline bool condition_carry()
 		{
-			return get_flag(FLAG_CARRY) == 0;
+#ifdef CPU_LAZY_FLAGS
+			if (lazy_flags_pending)
+			{
+				return (lazy_flags_result & 0x100) != 0;
+			}
+#endif
+			return (R.f & 0x10) != 0;
 		}
 
-		inline bool condition_carry()
+		inline bool condition_notcarry()
 		{
-			return get_flag(FLAG_CARRY) != 0;
+			return !condition_carry();
 		}
 
 		inline bool condition_invalid()
@@ -270,163 +413,66 @@ namespace gameboy
 			return false;
 		}
 
-		bool (*condition_funct[])(void) = { condition_notzero, condition_zero, condition_notcarry, condition_carry, condition_invalid, condition_invalid, condition_invalid, condition_invalid };
+		inline bool condition(u8 idx)
+		{
+			switch (idx)
+			{
+			case 0x0: return condition_notzero();
+			case 0x1: return condition_zero();
+			case 0x2: return condition_notcarry();
+			case 0x3: return condition_carry();
+			default: return condition_invalid();
+			}
+		}
 
 		// alu functions for instructions
 		inline void alu_add(u8* r)
 		{
 			u16 res = R.a + *r;
-
-			// set flags
-			clear_all_flags();
-
-			// check for carry
-			if (res & 0xFF00)
-			{
-				set_flag(FLAG_CARRY);
-			}
-
-			// check for the half carry
-			if ((R.a ^ *r ^ res) & 0x10)
-			{
-				set_flag(FLAG_HALFCARRY);
-			}
-
-			// set new value
+			set_result_flags(res, R.a ^ *r, 0x0);
 			R.a = (u8)(res & 0xFF);
-
-			if (R.a == 0)
-			{
-				set_flag(FLAG_ZERO);
-			}
 		}
 
 		inline void alu_add_carry(u8* r)
 		{
 			u16 value = *r + get_flag(FLAG_CARRY);
 			u16 res = R.a + value;
-			
-			// set flags
-			clear_all_flags();
-
-			// check for carry
-			if (res & 0xFF00)
-			{
-				set_flag(FLAG_CARRY);
-			}
-
-			// check for the half carry
-			if ((R.a ^ *r ^ res) & 0x10)
-			{
-				set_flag(FLAG_HALFCARRY);
-			}
-
-			// set new value
+			set_result_flags(res, R.a ^ *r, 0x0);
 			R.a = (u8)(res & 0xFF);
-
-			if (R.a == 0)
-			{
-				set_flag(FLAG_ZERO);
-			}
 		}
 
 		inline void alu_sub(u8* r)
 		{
+			// borrow wraps the result so bit 8 is the carry
 			u16 res = R.a - *r;
-
-			// set flags
-			clear_all_flags();
-			set_flag(FLAG_SUBTRACTION);
-		
-			// check for carry
-			if (*r > R.a)
-			{
-				set_flag(FLAG_CARRY);
-			}
-
-			// check for the half carry
-			if ((R.a ^ *r ^ res) & 0x10)
-			{
-				set_flag(FLAG_HALFCARRY);
-			}
-
-			// set new value
+			set_result_flags(res, R.a ^ *r, 0x40);
 			R.a = (u8)(res & 0xFF);
-
-			if (R.a == 0)
-			{
-				set_flag(FLAG_ZERO);
-			}
 		}
 
 		inline void alu_sub_carry(u8* r)
 		{
 			u16 value = *r + get_flag(FLAG_CARRY);
 			u16 res = R.a - value;
-
-			// set flags
-			clear_all_flags();
-			set_flag(FLAG_SUBTRACTION);
-
-			// check for carry
-			if (value > R.a)
-			{
-				set_flag(FLAG_CARRY);
-			}
-
-			// check for the half carry
-			if ((R.a ^ *r ^ res) & 0x10)
-			{
-				set_flag(FLAG_HALFCARRY);
-			}
-
-			// set new value
+			set_result_flags(res, R.a ^ *r, 0x40);
 			R.a = (u8)(res & 0xFF);
-
-			if (R.a == 0)
-			{
-				set_flag(FLAG_ZERO);
-			}
 		}
 		
 		inline void alu_and(u8* r)
 		{
 			R.a &= *r;
-
-			// set flags
-			clear_all_flags();
-			set_flag(FLAG_HALFCARRY);
-
-			if (R.a == 0)
-			{
-				set_flag(FLAG_ZERO);
-			}
+			set_result_flags(R.a, R.a ^ 0x10, 0x0); // half carry always set
 		}
 
 		inline void alu_xor(u8* r)
 		{
 			R.a ^= *r;
-
-			// set flags
-			clear_all_flags();
-
-			if (R.a == 0)
-			{
-				set_flag(FLAG_ZERO);
-			}
+			set_result_flags(R.a, R.a, 0x0);
 		}
 
 		inline void alu_or(u8* r)
 		{
 			R.a |= *r;
-
-			// set flags
-			clear_all_flags();
-
-			if (R.a == 0)
-			{
-				set_flag(FLAG_ZERO);
-			}
+			set_result_flags(R.a, R.a, 0x0);
 		}
 
 		inline void alu_cp(u8* r)
@@ -437,144 +483,94 @@ namespace gameboy
 			R.a = temp;
 		}
 
-		void(*alu_function[])(u8*) = { alu_add, alu_add_carry, alu_sub, alu_sub_carry, alu_and, alu_xor, alu_or, alu_cp };
+		inline void alu(u8 idx, u8* r)
+		{
+			switch (idx)
+			{
+			case 0x0: alu_add(r); break;
+			case 0x1: alu_add_carry(r); break;
+			case 0x2: alu_sub(r); break;
+			case 0x3: alu_sub_carry(r); break;
+			case 0x4: alu_and(r); break;
+			case 0x5: alu_xor(r); break;
+			case 0x6: alu_or(r); break;
+			default: alu_cp(r); break;
+			}
+		}
 
-		// rotation and shift operations
+		// rotation and shift operations. the carry out goes to bit 8 of the flag result
 		inline void rot_rlc(u8* r)
 		{
 			u8 carry = (*r & 0x80) >> 7;
 			*r = (*r << 1) | carry;
-
-			clear_all_flags();
-			if (carry)
-			{
-				set_flag(FLAG_CARRY);
-			}
-
-			if (*r == 0)
-			{
-				set_flag(FLAG_ZERO);
-			}
+			set_result_flags((carry << 8) | *r, *r, 0x0);
 		}
 
 		inline void rot_rrc(u8* r)
 		{
 			u8 carry = (*r & 0x1);
 			*r = (*r >> 1) | (carry << 7);
-
-			clear_all_flags();
-			if (carry)
-			{
-				set_flag(FLAG_CARRY);
-			}
-
-			if (*r == 0)
-			{
-				set_flag(FLAG_ZERO);
-			}
+			set_result_flags((carry << 8) | *r, *r, 0x0);
 		}
 
 		inline void rot_rl(u8* r)
 		{
 			u8 carry = get_flag(FLAG_CARRY);
-
-			clear_all_flags();
-			if ((*r >> 7))
-			{
-				set_flag(FLAG_CARRY);
-			}
-
+			u8 carry_out = (*r >> 7);
 			*r = (*r << 1) | carry;
-
-			if (*r == 0)
-			{
-				set_flag(FLAG_ZERO);
-			}
+			set_result_flags((carry_out << 8) | *r, *r, 0x0);
 		}
 
 		inline void rot_rr(u8* r)
 		{
 			u8 carry = get_flag(FLAG_CARRY);
-
-			clear_all_flags();
-			if (*r & 0x1)
-			{
-				set_flag(FLAG_CARRY);
-			}
-
+			u8 carry_out = (*r & 0x1);
 			*r = (*r >> 1) | (carry << 7);
-
-			if (*r == 0)
-			{
-				set_flag(FLAG_ZERO);
-			}
+			set_result_flags((carry_out << 8) | *r, *r, 0x0);
 		}
 
 		inline void rot_sla(u8* r)
 		{
-			clear_all_flags();
-			if (*r & 0x80)
-			{
-				set_flag(FLAG_CARRY);
-			}
-
+			u8 carry_out = (*r >> 7);
 			*r <<= 1;
-
-			// if set zero flag
-			if (*r == 0)
-			{
-				set_flag(FLAG_ZERO);
-			}
+			set_result_flags((carry_out << 8) | *r, *r, 0x0);
 		}
 
 		inline void rot_sra(u8* r)
 		{
-			clear_all_flags();
-			if (*r & 0x1)
-			{
-				set_flag(FLAG_CARRY);
-			}
-
+			u8 carry_out = (*r & 0x1);
 			*r = (*r & 0x80) | (*r >> 1); // high bit stays
-
-			// set zero flag
-			if (*r == 0)
-			{
-				set_flag(FLAG_ZERO);
-			}
+			set_result_flags((carry_out << 8) | *r, *r, 0x0);
 		}
 
 		inline void rot_swap(u8* r)
 		{
-			clear_all_flags();
 			*r = ((*r & 0x0F) << 4) | ((*r & 0xF0) >> 4);
-
-			// set zero flag
-			if (*r == 0)
-			{
-				set_flag(FLAG_ZERO);
-			}
+			set_result_flags(*r, *r, 0x0);
 		}
 
 		inline void rot_srl(u8* r)
 		{
-			clear_all_flags();
-			if (*r & 0x1)
-			{
-				set_flag(FLAG_CARRY);
-			}
-
+			u8 carry_out = (*r & 0x1);
 			*r >>= 1; // high bit 0
+			set_result_flags((carry_out << 8) | *r, *r, 0x0);
+		}
 
-			// set zero flag
-			if (*r == 0)
-			{
-				set_flag(FLAG_ZERO);
+		inline void rot(u8 idx, u8* r)
+		{
+			switch (idx)
+			{
+			case 0x0: rot_rlc(r); break;
+			case 0x1: rot_rrc(r); break;
+			case 0x2: rot_rl(r); break;
+			case 0x3: rot_rr(r); break;
+			case 0x4: rot_sla(r); break;
+			case 0x5: rot_sra(r); break;
+			case 0x6: rot_swap(r); break;
+			default: rot_srl(r); break;
 			}
 		}
 
-		void(*rot_function[])(u8*) = { rot_rlc , rot_rrc, rot_rl, rot_rr, rot_sla, rot_sra, rot_swap, rot_srl };
-
 		// read 8 and 16 bit at PC. increment PC
 		inline u8 readpc_u8()
 		{
@@ -629,6 +625,7 @@ namespace gameboy
 		void request_joypad_interrupt()
 		{
 			set_request_interrupt_flag(cpu::INTERRUPT_JOYPAD);
+			stop = false; // a button press leaves stop mode
 		}
 
 		// interrupt enable function
@@ -755,57 +752,146 @@ namespace gameboy
 			return 0;
 		}
 
-		void reset_timer_counter()
+		// divide register is 16384 hz
+		u8 read_divider()
 		{
-			timer_counter = get_timer_frequency();
-			*timer_value = *timer_modulator;
+			*divide_value = (u8)(divide_offset + scheduler::cycles / 256);
+			return *divide_value;
 		}
 
-		int update_timer(u8 cycles)
+		void reset_divider()
 		{
-			gpu::update(cycles);
-			gpu::check_coincidence_flag();
+			divide_offset = (u8)(0 - scheduler::cycles / 256);
+			*divide_value = 0x0;
+		}
 
-			// update divide register first
-			divide_counter -= cycles;
+		// the divider has nothing to catch up. only tell idle loop skipping the cycle it changes on next
+		void divider_catch_up(u64 until_cycles)
+		{
+			scheduler::set_lazy_cycles(scheduler::LAZY_DIVIDER, (until_cycles / 256 + 1) * 256);
+		}
 
-			while (divide_counter <= 0) // divide register is 16382 hz
+		// add the ticks due up to until_cycles to the timer in one step. past an overflow the timer counts up from the
+		// modulator again
+		void timer_catch_up(u64 until_cycles)
+		{
+			if (timer_tick_cycles <= until_cycles)
 			{
-				(*divide_value)++;
-				divide_counter += 256;
+				u32 period = get_timer_frequency();
+				u64 ticks = (until_cycles - timer_tick_cycles) / period + 1;
+				u32 ticks_to_overflow = 0x100 - *timer_value;
+
+				if (ticks < ticks_to_overflow)
+				{
+					*timer_value += (u8)ticks;
+				}
+				else
+				{
+					*timer_value = *timer_modulator + (u8)((ticks - ticks_to_overflow) % (0x100 - *timer_modulator));
+				}
+
+				timer_tick_cycles += ticks * period;
 			}
 
-			if (!timer_enabled())
+			scheduler::set_lazy_cycles(scheduler::LAZY_TIMER, timer_tick_cycles);
+		}
+
+		// the only timer event is the tick that overflows it. worked out again when the timer registers are written
+		void schedule_timer_overflow()
+		{
+			scheduler::set_lazy_cycles(scheduler::LAZY_TIMER, timer_tick_cycles);
+
+			if (timer_tick_cycles == scheduler::event_none)
 			{
-				return 0;
+				scheduler::cancel_event(scheduler::EVENT_TIMER);
+				return;
 			}
 
-			timer_counter -= cycles;
+			scheduler::schedule_event(scheduler::EVENT_TIMER, timer_tick_cycles + (u64)(0xFF - *timer_value) * get_timer_frequency());
+		}
 
-			while (timer_counter <= 0)
+		u8 read_timer()
+		{
+			timer_catch_up(scheduler::cycles);
+			return *timer_value;
+		}
+
+		void timer_event(u64 event_cycles)
+		{
+			// the timer overflowed. it is set to the modulator by the catch up
+			timer_catch_up(event_cycles);
+
+			// interrupt
+			set_request_interrupt_flag(INTERRUPT_TIMER);
+
+			schedule_timer_overflow();
+		}
+
+		void update_timer_control(u8 old_controller)
+		{
+			if (timer_controller == nullptr) // memory reset before the cpu is initialized. cpu::reset schedules the timer
 			{
-				// check if overflow. set timer_counter to modulator. increase timer
-				if (*timer_value == 0xFF)
-				{
-					*timer_value = *timer_modulator;
+				return;
+			}
 
-					// interrupt
-					set_request_interrupt_flag(INTERRUPT_TIMER);
-				}
-				else
-				{
-					(*timer_value)++;
-				}
+			// timer_counter holds the cycles left to the next tick while the timer is stopped
+			if (timer_tick_cycles != scheduler::event_none)
+			{
+				timer_counter = (s32)(timer_tick_cycles - scheduler::cycles);
+			}
 
-				// set counter back to frequency
-				timer_counter += get_timer_frequency();
+			if ((old_controller & 0x3) != (*timer_controller & 0x3)) // frequency changed. reset the timer
+			{
+				timer_counter = get_timer_frequency();
+				*timer_value = *timer_modulator;
 			}
 
+			timer_tick_cycles = (timer_enabled() ? scheduler::cycles + (s64)timer_counter : scheduler::event_none);
+			schedule_timer_overflow();
+		}
+
+		inline int update_timer(u8 cycles)
+		{
+			// advance the master clock. timer and lcd only run when one of their events is due
+			scheduler::add_cycles(cycles);
+
 			return 0;
 		}
 
+		// a halted cpu re-executes HALT every 4 cycles until an interrupt is pending. skip straight to the next
+		// scheduled event instead, charging the cycles to the timer and lcd in one step. returns the cycles skipped
+		u32 fast_forward_halt(u32 max_cycles)
+		{
+			if (!halt || eiOcccurred || paused || debug_hooks_armed)
+			{
+				return 0;
+			}
+
+			if ((*interrupt_enable_flag & *interrupt_request_flag & 0x1F) != 0x0) // pending interrupt wakes the cpu
+			{
+				return 0;
+			}
+
+			u64 cycles_to_event = scheduler::next_event_cycles - scheduler::cycles;
+			if (cycles_to_event > max_cycles)
+			{
+				cycles_to_event = max_cycles;
+			}
+
+			// whole halt steps up to and including the one the event is due in
+			u32 skip_cycles = ((u32)cycles_to_event + 3) & ~3u;
+			scheduler::add_cycles(skip_cycles);
+
+			return skip_cycles;
+		}
+
 		int reset()
 		{
+			scheduler::reset();
+			scheduler::set_event_handler(scheduler::EVENT_TIMER, timer_event);
+			scheduler::set_lazy_handler(scheduler::LAZY_DIVIDER, divider_catch_up);
+			scheduler::set_lazy_handler(scheduler::LAZY_TIMER, timer_catch_up);
+
 			memset(&R, 0x0, sizeof(R)); // init registers to 0
 			
 			R.af = 0x0000;
@@ -836,16 +922,21 @@ namespace gameboy
 			timer_modulator = memory_module::get_memory(0xFF06);
 			timer_controller = memory_module::get_memory(0xFF07);
 			timer_counter = 0;
+			timer_tick_cycles = (timer_enabled() ? timer_counter : scheduler::event_none);
+			schedule_timer_overflow();
 			
 			divide_value = memory_module::get_memory(0xFF04);
-			divide_counter = 256;
+			divide_offset = *divide_value;
+			divider_catch_up(scheduler::cycles);
 
+			lazy_flags_pending = false;
 			paused = false;
 			running = true;
 			eiOcccurred = false;
 			halt = false;
 			halt_bug = false;
 			halt_continue_exec = false;
+			stop = false;
 			breakpoint_hit = false;
 			breakpoint_disable_one_instr = false;
 			memory_breakpoint_last_addr = -1;
@@ -860,7 +951,100 @@ namespace gameboy
 			return 0;
 		}
 
-		bool check_memory_breakpoint(u16 pc, u16 addr)
+		// breakpoint bitmap helpers
+		inline bool get_bitmap(const u64* bitmap, u16 addr)
+		{
+			return ((bitmap[addr >> 6] >> (addr & 0x3F)) & 0x1) != 0;
+		}
+
+		inline void set_bitmap(u64* bitmap, u16 addr, bool value)
+		{
+			if (value)
+			{
+				bitmap[addr >> 6] |= (1ull << (addr & 0x3F));
+			}
+			else
+			{
+				bitmap[addr >> 6] &= ~(1ull << (addr & 0x3F));
+			}
+		}
+
+		void update_debug_hooks()
+		{
+#ifndef CPU_NO_DEBUGGER
+			debug_hooks_armed = breakpoints.size() > 0 || soft_breakpoints.size() > 0 || memory_breakpoints.size() > 0;
+#endif
+		}
+
+		inline bool has_breakpoint(u16 addr)
+		{
+			return get_bitmap(breakpoint_bitmap, addr);
+		}
+
+		inline bool has_memory_breakpoint(u16 addr)
+		{
+			return get_bitmap(memory_breakpoint_bitmap, addr);
+		}
+
+		void toggle_breakpoint(u16 addr)
+		{
+			auto itr = std::find(breakpoints.begin(), breakpoints.end(), addr);
+			bool is_set = (itr != breakpoints.end());
+
+			if (is_set)
+			{
+				breakpoints.erase(itr);
+			}
+			else
+			{
+				breakpoints.push_back(addr);
+			}
+
+			set_bitmap(breakpoint_bitmap, addr, !is_set);
+			update_debug_hooks();
+		}
+
+		void toggle_memory_breakpoint(u16 addr)
+		{
+			auto itr = std::find(memory_breakpoints.begin(), memory_breakpoints.end(), addr);
+			bool is_set = (itr != memory_breakpoints.end());
+
+			if (is_set)
+			{
+				memory_breakpoints.erase(itr);
+			}
+			else
+			{
+				memory_breakpoints.push_back(addr);
+			}
+
+			set_bitmap(memory_breakpoint_bitmap, addr, !is_set);
+			update_debug_hooks();
+		}
+
+		void add_soft_breakpoint(u16 addr)
+		{
+			if (!get_bitmap(soft_breakpoint_bitmap, addr))
+			{
+				soft_breakpoints.push_back(addr);
+				set_bitmap(soft_breakpoint_bitmap, addr, true);
+				update_debug_hooks();
+			}
+		}
+
+		void remove_soft_breakpoint(u16 addr)
+		{
+			auto itr = std::find(soft_breakpoints.begin(), soft_breakpoints.end(), addr);
+
+			if (itr != soft_breakpoints.end())
+			{
+				soft_breakpoints.erase(itr);
+				set_bitmap(soft_breakpoint_bitmap, addr, false);
+				update_debug_hooks();
+			}
+		}
+
+		bool check_memory_breakpoint_slow(u16 pc, u16 addr)
 		{
 			if (addr == memory_breakpoint_last_addr)
 			{
@@ -868,25 +1052,67 @@ namespace gameboy
 				return false;
 			}
 
-			if (memory_breakpoints.size() > 0)
+			if (has_memory_breakpoint(addr))
+			{
+				paused = true;
+				breakpoint_hit = true;
+				memory_breakpoint_last_addr = addr;
+
+				R.pc = pc; // assuming we back 1 byte to previous opcode. assuming non prefix dont write memory
+				add_soft_breakpoint(R.pc);
+				return true;
+			}
+
+			return false;
+		}
+
+		inline bool check_memory_breakpoint(u16 pc, u16 addr)
+		{
+			if (!debug_hooks_armed)
+			{
+				return false;
+			}
+
+			return check_memory_breakpoint_slow(pc, addr);
+		}
+
+		// returns true if the cpu stops before executing the instruction at pc
+		bool check_breakpoints()
+		{
+			if (!breakpoint_disable_one_instr)
 			{
-				auto memory_breakpoint_itr = std::find(memory_breakpoints.begin(), memory_breakpoints.end(), addr);
-				if (memory_breakpoint_itr != memory_breakpoints.end())
+				if (has_breakpoint(R.pc))
 				{
 					paused = true;
 					breakpoint_hit = true;
-					memory_breakpoint_last_addr = addr;
+					return true;
+				}
+
+				// soft breakpoints are used for step over. not visible
+				if (get_bitmap(soft_breakpoint_bitmap, R.pc))
+				{
+					if (memory_breakpoint_last_addr == -1) // hacky to get mem breakpoints working
+					{
+						paused = true;
+						breakpoint_hit = true;
+					}
 
-					R.pc = pc; // assuming we back 1 byte to previous opcode. assuming non prefix dont write memory
-					soft_breakpoints.push_back(R.pc);
+					remove_soft_breakpoint(R.pc);
 					return true;
 				}
 			}
 
+			if (breakpoint_disable_one_instr)
+			{
+				breakpoint_hit = true;
+				breakpoint_disable_one_instr = false;
+			}
+
 			return false;
 		}
 
-		int decode_nonprefixed(u8 opcode)
+		template <typename OPCODE>
+		inline int decode_nonprefixed_impl(const OPCODE opcode)
 		{
 			u8 x = (opcode >> 6);
 			u8 y = (opcode >> 3) & 0x7;
@@ -927,8 +1153,12 @@ namespace gameboy
 						break;
 					}
 					case 0x2:
-						// STOP
-						running = false;
+						// STOP. clock is stopped until a button is pressed
+						readpc_u8(); // stop is followed by 0x00
+						stop = true;
+						reset_divider();
+						cycles = 4;
+						update_timer(4);
 						break;
 					case 0x3:
 						// JR d
@@ -947,7 +1177,7 @@ namespace gameboy
 						s8 val = (s8)readpc_u8();
 
 						// JR conditions[y - 4], d - relative jump
-						if (condition_funct[y - 4]())
+						if (condition(y - 4))
 						{
 							R.pc += val; // relative jump is singed offset
 							cycles += 4;
@@ -966,13 +1196,13 @@ namespace gameboy
 					{
 					case 0x0:
 						// LD register_pairs[p] with nn
-						*register_pairs[p] = readpc_u16();
+						reg16(p) = readpc_u16();
 						cycles = 12;
 						update_timer(12);
 						break;
 					case 0x1:
 						// ADD HL with register_pairs[p]
-						u32 res = R.hl + *register_pairs[p];
+						u32 res = R.hl + reg16(p);
 
 						// check for carry
 						if (res & 0xFFFF0000)
@@ -985,7 +1215,7 @@ namespace gameboy
 						}
 
 						// check for the half carry.
-						if ((R.hl & 0xFFF) + (*register_pairs[p] & 0xFFF) > 0xFFF)
+						if ((R.hl & 0xFFF) + (reg16(p) & 0xFFF) > 0xFFF)
 						{
 							set_flag(FLAG_HALFCARRY);
 						}
@@ -1103,13 +1333,13 @@ namespace gameboy
 					{
 					case 0x0:
 						// INC register_pairs[p]
-						(*register_pairs[p])++;
+						reg16(p)++;
 						cycles = 8;
 						update_timer(8);
 						break;
 					case 0x1:
 						// DEC register_pairs[p]
-						(*register_pairs[p])--;
+						reg16(p)--;
 						cycles = 8;
 						update_timer(8);
 						break;
@@ -1119,8 +1349,10 @@ namespace gameboy
 				case 0x4: // z = 4
 				{
 					// INC register_single[y]
+					u8 val = read_reg8(y);
+
 					// check for the half carry only
-					if ((*register_single[y] & 0xF) == 0x0F)
+					if ((val & 0xF) == 0x0F)
 					{
 						set_flag(FLAG_HALFCARRY);
 					}
@@ -1129,7 +1361,7 @@ namespace gameboy
 						clear_flag(FLAG_HALFCARRY);
 					}
 
-					u8 val = *register_single[y] + 1;
+					val++;
 
 					if (y == 6) // register (HL)
 					{
@@ -1138,7 +1370,7 @@ namespace gameboy
 					}
 
 					// set new value
-					*register_single[y] = val;
+					write_reg8(y, val);
 
 					if (y == 6) // register (HL)
 					{
@@ -1146,7 +1378,7 @@ namespace gameboy
 						update_timer(4);
 					}
 
-					if (*register_single[y] == 0)
+					if (val == 0)
 					{
 						set_flag(FLAG_ZERO);
 					}
@@ -1164,8 +1396,10 @@ namespace gameboy
 				case 0x5: // z = 5
 				{
 					// DEC register_single[y]
+					u8 val = read_reg8(y);
+
 					// check for the half carry only
-					if (*register_single[y] & 0x0F)
+					if (val & 0x0F)
 					{
 						clear_flag(FLAG_HALFCARRY);
 					}
@@ -1174,7 +1408,7 @@ namespace gameboy
 						set_flag(FLAG_HALFCARRY);
 					}
 
-					u8 val = *register_single[y] - 1;
+					val--;
 
 					if (y == 6) // register (HL)
 					{
@@ -1183,7 +1417,7 @@ namespace gameboy
 					}
 
 					// set new value
-					*register_single[y] = val;
+					write_reg8(y, val);
 
 					if (y == 6) // register (HL)
 					{
@@ -1191,7 +1425,7 @@ namespace gameboy
 						update_timer(4);
 					}
 
-					if (*register_single[y] == 0)
+					if (val == 0)
 					{
 						set_flag(FLAG_ZERO);
 					}
@@ -1214,7 +1448,7 @@ namespace gameboy
 						update_timer(4);
 					}
 
-					*register_single[y] = readpc_u8();
+					write_reg8(y, readpc_u8());
 
 					cycles += 8;
 					update_timer(8);
@@ -1404,7 +1638,7 @@ namespace gameboy
 				else
 				{
 					// LD register_single[y] with register_single[z]
-					*register_single[y] = *register_single[z];
+					write_reg8(y, read_reg8(z));
 
 					if (y == 6 || z == 6) // LD (HL), A,B,C,F,E,F,H,L or LD A,B,C,F,E,H,L, (HL)
 					{
@@ -1420,7 +1654,8 @@ namespace gameboy
 			case 0x2: // x = 2
 			{
 				// alu[y] with register_single[z]
-				alu_function[y](register_single[z]);
+				u8 val = read_reg8(z);
+				alu(y, &val);
 
 				if (z == 6) // using (HL) register
 				{
@@ -1445,7 +1680,7 @@ namespace gameboy
 					case 0x2:
 					case 0x3:
 						// RET if condition_funct[y]
-						if (condition_funct[y]())
+						if (condition(y))
 						{
 							R.pc = pop_from_stack();
 							cycles += 12;
@@ -1580,7 +1815,7 @@ namespace gameboy
 							addr &= 0xFFF0;
 						}
 
-						*(register_pairs2[p]) = addr;
+						reg16_af(p) = addr;
 						cycles = 12;
 						update_timer(12);
 					}
@@ -1631,7 +1866,7 @@ namespace gameboy
 					{
 						// JP to nn if condition_funct[y]
 						u16 val = readpc_u16();
-						if (condition_funct[y]())
+						if (condition(y))
 						{
 							R.pc = val;
 							cycles += 4;
@@ -1754,7 +1989,7 @@ namespace gameboy
 					{
 						// CALL nn if condition_funct[y]
 						u16 val = readpc_u16();
-						if (condition_funct[y]())
+						if (condition(y))
 						{
 							push_sp_to_stack(R.pc);
 
@@ -1783,7 +2018,7 @@ namespace gameboy
 					if (q == 0)
 					{
 						// PUSH register_pairs2[p]
-						push_sp_to_stack(*register_pairs2[p]);
+						push_sp_to_stack(reg16_af(p));
 
 						cycles = 16;
 						update_timer(16);
@@ -1812,7 +2047,7 @@ namespace gameboy
 				{
 					// alu[y] with n
 					u8 value = readpc_u8();
-					alu_function[y](&value);
+					alu(y, &value);
 					cycles = 8;
 					update_timer(8);
 					break;
@@ -1844,13 +2079,12 @@ namespace gameboy
 			return cycles;
 		}
 
-		int decode_prefixed_cb(u8 opcode)
+		template <typename OPCODE>
+		inline int decode_prefixed_cb_impl(const OPCODE opcode)
 		{
 			u8 x = (opcode >> 6);
 			u8 y = (opcode >> 3) & 0x7;
 			u8 z = (opcode & 0x7);
-			u8 p = (opcode >> 4) & 0x3;
-			u8 q = (opcode >> 3) & 0x1;
 
 			u8 cycles = 0;
 
@@ -1865,8 +2099,8 @@ namespace gameboy
 					update_timer(4);
 				}
 
-				u8 val = *register_single[z];
-				rot_function[y](&val);
+				u8 val = read_reg8(z);
+				rot(y, &val);
 
 				if (z == 6) // (HL) register
 				{
@@ -1874,7 +2108,7 @@ namespace gameboy
 					update_timer(4);
 				}
 
-				*register_single[z] = val;
+				write_reg8(z, val);
 
 				cycles += 8;
 				update_timer(8);
@@ -1888,7 +2122,7 @@ namespace gameboy
 					update_timer(4);
 				}
 
-				if (*register_single[z] & (1 << y))
+				if (read_reg8(z) & (1 << y))
 				{
 					clear_flag(FLAG_ZERO);
 				}
@@ -1912,7 +2146,7 @@ namespace gameboy
 					update_timer(4);
 				}
 
-				u8 val = *register_single[z];
+				u8 val = read_reg8(z);
 				val &= ~(1 << y);
 
 				if (z == 6) // (HL) register
@@ -1921,7 +2155,7 @@ namespace gameboy
 					update_timer(4);
 				}
 
-				*register_single[z] = val;
+				write_reg8(z, val);
 
 				cycles += 8;
 				update_timer(8);
@@ -1936,7 +2170,7 @@ namespace gameboy
 					update_timer(4);
 				}
 
-				u8 val = *register_single[z];
+				u8 val = read_reg8(z);
 				val |= (1 << y);
 
 				if (z == 6) // (HL) register
@@ -1945,7 +2179,7 @@ namespace gameboy
 					update_timer(4);
 				}
 
-				*register_single[z] = val;
+				write_reg8(z, val);
 
 				cycles += 8;
 				update_timer(8);
@@ -1958,74 +2192,74 @@ namespace gameboy
 			return cycles;
 		}
 		
-		int execute_opcode()
+		// reference decoder. derives the opcode fields and walks the decode switches at runtime
+		int decode_nonprefixed(u8 opcode)
 		{
-			if (!running || (paused && !breakpoint_disable_one_instr))
-			{
-				// processor is stopped
-				return 0;
-			}
+			return decode_nonprefixed_impl(opcode);
+		}
 
-			// check for hitting breakpoints to pause
-			if (!breakpoint_disable_one_instr)
-			{
-				if (breakpoints.size() > 0)
-				{
-					auto breakpoint_itr = std::find(breakpoints.begin(), breakpoints.end(), R.pc);
-					if (breakpoint_itr != breakpoints.end())
-					{
-						paused = true;
-						breakpoint_hit = true;
-						return 0;
-					}
-				}
+		int decode_prefixed_cb(u8 opcode)
+		{
+			return decode_prefixed_cb_impl(opcode);
+		}
 
-				// soft breakpoints are used for step over. not visible
-				if (soft_breakpoints.size() > 0)
-				{
-					auto breakpoint_itr = std::find(soft_breakpoints.begin(), soft_breakpoints.end(), R.pc);
-					if (breakpoint_itr != soft_breakpoints.end())
-					{
-						if (memory_breakpoint_last_addr == -1) // hacky to get mem breakpoints working
-						{
-							paused = true;
-							breakpoint_hit = true;
-						}
+		// table decoder. each opcode gets its own instance of the decoder with the opcode as a compile time constant,
+		// so the decode switches and register selects fold away and only the instruction itself is left
+		typedef int(*opcode_handler)();
 
-						soft_breakpoints.erase(breakpoint_itr);
-						return 0;
-					}
-				}
-			}
+		template <u8 opcode>
+		int execute_prefixed_cb()
+		{
+			return decode_prefixed_cb_impl(std::integral_constant<u8, opcode>());
+		}
 
-			if (breakpoint_disable_one_instr)
+		template <size_t... opcodes>
+		constexpr std::array<opcode_handler, 256> build_prefixed_cb_table(std::index_sequence<opcodes...>)
+		{
+			return { { &execute_prefixed_cb<(u8)opcodes>... } };
+		}
+
+		const std::array<opcode_handler, 256> prefixed_cb_table = build_prefixed_cb_table(std::make_index_sequence<256>());
+
+		template <u8 opcode>
+		int execute_nonprefixed()
+		{
+			if constexpr (opcode == 0xCB)
 			{
-				breakpoint_hit = true;
-				breakpoint_disable_one_instr = false;
+				return prefixed_cb_table[readpc_u8()]();
 			}
-			
-			// need to point this to mem. small hack for the (HL) register instructons
-			register_single[6] = memory_module::get_memory(R.hl); 
-			u8 temp_mem = 0xFF;
-			if (register_single[6] == 0x0)
+			else
 			{
-				register_single[6] = &temp_mem;
+				return decode_nonprefixed_impl(std::integral_constant<u8, opcode>());
 			}
+		}
+
+		template <size_t... opcodes>
+		constexpr std::array<opcode_handler, 256> build_nonprefixed_table(std::index_sequence<opcodes...>)
+		{
+			return { { &execute_nonprefixed<(u8)opcodes>... } };
+		}
 
-			// update the joypad register
-			u8 joypad_register = memory_module::read_memory(0xFF00);
-			joypad_register &= 0xF0; // keep upper bits
+		const std::array<opcode_handler, 256> nonprefixed_table = build_nonprefixed_table(std::make_index_sequence<256>());
 
-			if ((joypad_register & 0x20) == 0)
+		int execute_opcode()
+		{
+			if (!running || (paused && !breakpoint_disable_one_instr))
 			{
-				// directional keys are set
-				joypad_register |= (get_button_register(false) & 0xF); // only lower 4 bits
+				// processor is stopped
+				return 0;
 			}
-			else
+
+#ifndef CPU_NO_DEBUGGER
+			// check for hitting breakpoints to pause. nothing to do unless the debugger armed one
+			if (debug_hooks_armed || breakpoint_disable_one_instr)
 			{
-				joypad_register |= (get_button_register(true) & 0xF); // only lower 4 bits
+				if (check_breakpoints())
+				{
+					return 0;
+				}
 			}
-			memory_module::write_memory(0xFF00, joypad_register);
+#endif
 
 			u8 cycles = 0;
 
@@ -2038,6 +2272,7 @@ namespace gameboy
 				halt_bug = false;
 			}
 
+#ifdef CPU_REFERENCE_DECODER
 			// decode. gameboy only has CB prefix
 			if (opcode == 0xCB)
 			{
@@ -2048,6 +2283,11 @@ namespace gameboy
 			{
 				cycles = decode_nonprefixed(opcode);
 			}
+#else
+			cycles = nonprefixed_table[opcode]();
+#endif
+
+			materialize_flags();
 
 			if (cycles == 0)
 			{
@@ -2056,5 +2296,227 @@ namespace gameboy
 
 			return cycles;
 		}
+
+		// byte length of a non prefixed instruction. 0 for opcodes the gameboy does not support
+		u8 get_instruction_length(u8 opcode)
+		{
+			switch (opcode)
+			{
+			case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: case 0xEB: case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+				return 0;
+			case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x36: case 0x3E: // LD r, n
+			case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE: // ALU A, n
+			case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // STOP, JR
+			case 0xE0: case 0xF0: case 0xE8: case 0xF8: case 0xCB: // LDH, ADD SP, LD HL SP+n, prefix
+				return 2;
+			case 0x01: case 0x11: case 0x21: case 0x31: case 0x08: // LD rr, nn. LD (nn), SP
+			case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: // JP
+			case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC: // CALL
+			case 0xEA: case 0xFA: // LD (nn), A. LD A, (nn)
+				return 3;
+			}
+
+			return 1;
+		}
+
+		// instructions that change pc or the cpu state. they end a block
+		bool is_block_end(u8 opcode)
+		{
+			switch (opcode)
+			{
+			case 0x10: case 0x76: case 0xFB: // STOP, HALT, EI
+			case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // JR
+			case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9: // JP
+			case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC: // CALL
+			case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: case 0xD9: // RET, RETI
+			case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: // RST
+				return true;
+			}
+
+			return false;
+		}
+
+		// decode the run of instructions starting at addr. null if the first instruction can not be cached
+		block_cache::block* build_block(u16 addr)
+		{
+			u16 addr_limit = block_cache::get_block_limit(addr);
+
+			block_cache::block* new_block = new block_cache::block();
+			new_block->addr_start = addr;
+			new_block->addr_end = addr;
+			new_block->cycles = 0;
+			new_block->op_count = 0;
+			new_block->jit_allowed = addr < 0x8000;
+			new_block->run_count = 0;
+			new_block->jit_code = nullptr;
+
+			while (new_block->op_count < block_cache::max_block_ops)
+			{
+				u8 opcode = memory_module::read_memory(addr, true);
+				u8 length = get_instruction_length(opcode);
+
+				if (length == 0 || (u32)addr + length - 1 > addr_limit)
+				{
+					break;
+				}
+
+				block_cache::block_op& op = new_block->ops[new_block->op_count++];
+				op.length = length;
+
+				// io register accesses stay in the interpreter
+				if (opcode == 0xE0 || opcode == 0xF0 || opcode == 0xE2 || opcode == 0xF2 ||
+					((opcode == 0xEA || opcode == 0xFA) && memory_module::read_memory(addr + 2, true) == 0xFF))
+				{
+					new_block->jit_allowed = false;
+				}
+
+				if (opcode == 0xCB)
+				{
+					u8 cb_opcode = memory_module::read_memory(addr + 1, true);
+					op.handler = prefixed_cb_table[cb_opcode];
+					op.opcode_length = 2;
+					new_block->cycles += instruction_times_cb[cb_opcode] * 4;
+				}
+				else
+				{
+					op.handler = nonprefixed_table[opcode];
+					op.opcode_length = 1;
+					new_block->cycles += std::max(instruction_times_condition[opcode], instruction_times_nocondition[opcode]) * 4;
+				}
+
+				new_block->addr_end = addr + length - 1;
+				addr += length;
+
+				if (is_block_end(opcode))
+				{
+					break;
+				}
+			}
+
+			if (new_block->op_count == 0)
+			{
+				delete new_block;
+				return nullptr;
+			}
+
+			return new_block;
+		}
+
+		// run the ops of a cached block from first_op on. the early exits are checked in front of every op after the
+		// first. opcode_pc is set to the pc of the last op run. the jit hands blocks over to this part way through
+		inline int run_block_ops(const block_cache::block* cached_block, u8 first_op, int cycles, s32 max_cycles, u16* opcode_pc, s32 stop_pc)
+		{
+			// a write to the code may delete the block. nothing of it is read after the page tables changed
+			const u8 op_count = cached_block->op_count;
+			const u32 page_table_generation = memory_module::page_table_generation;
+			const bool check_cycles = (s32)cached_block->cycles > max_cycles; // whole block fits in the frame otherwise
+
+			for (u8 i = first_op; i < op_count; i++)
+			{
+				if (i > first_op)
+				{
+					if (page_table_generation != memory_module::page_table_generation || (check_cycles && cycles >= max_cycles) || R.pc == stop_pc ||
+						eiOcccurred || (*interrupt_enable_flag & *interrupt_request_flag & 0x1F) != 0x0)
+					{
+						break;
+					}
+
+					*opcode_pc = R.pc;
+				}
+
+				const block_cache::block_op& op = cached_block->ops[i];
+
+#ifdef MEMORY_STATS
+				memory_stats::count_fetch(R.pc, op.opcode_length);
+#endif
+
+				R.pc += op.opcode_length;
+				cycles += op.handler();
+			}
+
+			return cycles;
+		}
+
+		// run the cached block at pc. stops early wherever the instruction loop would do something other than run the
+		// next instruction: a pending interrupt or ei, the end of the frame, the stop pc or a remapped page.
+		// opcode_pc is set to the pc of the last instruction run
+		int execute_block(s32 max_cycles, u16& opcode_pc, s32 stop_pc)
+		{
+			opcode_pc = R.pc;
+
+#if !defined(CPU_NO_BLOCK_CACHE) && !defined(CPU_REFERENCE_DECODER)
+			if (!running || paused || halt_bug || debug_hooks_armed || breakpoint_disable_one_instr)
+			{
+				return execute_opcode();
+			}
+
+			block_cache::block** slot = block_cache::get_block_slot(R.pc);
+			if (slot == nullptr)
+			{
+				return execute_opcode();
+			}
+
+			if (*slot == nullptr)
+			{
+				block_cache::block* new_block = build_block(R.pc);
+				if (new_block == nullptr)
+				{
+					return execute_opcode();
+				}
+
+				block_cache::add_block(slot, new_block);
+			}
+
+			block_cache::block* cached_block = *slot;
+
+			if (jit::enabled && cached_block->jit_code == nullptr && ++cached_block->run_count == jit::compile_threshold)
+			{
+				cached_block->jit_code = jit::compile_block(cached_block);
+			}
+
+			int cycles = (cached_block->jit_code ? cached_block->jit_code(max_cycles, &opcode_pc, stop_pc) : run_block_ops(cached_block, 0, 0, max_cycles, &opcode_pc, stop_pc));
+
+			// the rest of the emulator reads F directly
+			materialize_flags();
+
+			return cycles;
+#else
+			return execute_opcode();
+#endif
+		}
+
+		// translate hot blocks to native code. needs the block cache
+		void enable_jit()
+		{
+#if !defined(CPU_NO_BLOCK_CACHE) && !defined(CPU_REFERENCE_DECODER) && defined(JIT_X64)
+			jit::context ctx = {};
+			ctx.registers = (u8*)&R;
+			for (u8 i = 0; i < 8; i++)
+			{
+				ctx.reg8[i] = (i != 0x6 ? &reg8(i) : nullptr);
+			}
+			for (u8 i = 0; i < 4; i++)
+			{
+				ctx.reg16[i] = &reg16(i);
+			}
+			ctx.f = &R.f;
+			ctx.pc = &R.pc;
+			ctx.page_table_generation = &memory_module::page_table_generation;
+			ctx.ei_occurred = &eiOcccurred;
+			ctx.interrupt_enable_flag = &interrupt_enable_flag;
+			ctx.interrupt_request_flag = &interrupt_request_flag;
+			ctx.cycles = &scheduler::cycles;
+			ctx.next_event_cycles = &scheduler::next_event_cycles;
+#ifdef CPU_LAZY_FLAGS
+			ctx.materialize_flags = materialize_flags;
+#endif
+			ctx.run_block_ops = run_block_ops;
+
+			jit::initialize(ctx);
+			jit::enabled = true;
+#else
+			printf("Jit is not supported in this build. running the interpreter\n");
+#endif
+		}
 	}
 }
\ No newline at end of file
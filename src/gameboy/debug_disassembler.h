@@ -312,16 +312,22 @@ namespace gameboy
 				}
 
 				// check if breakpoint is set.
-				auto breakpoint_itr = std::find(cpu::breakpoints.begin(), cpu::breakpoints.end(), sym.addr);
-				if (breakpoint_itr != cpu::breakpoints.end())
+				bool is_breakpoint = cpu::has_breakpoint(sym.addr);
+				if (is_breakpoint)
 				{
 					line_border.setFillColor(line_border.getFillColor() + sf::Color(50, 0, 0, 0));
 				}
 
+				// tint detected idle loops
+				if (idle_loop::is_in_detected_loop(sym.addr))
+				{
+					line_border.setFillColor(line_border.getFillColor() + sf::Color(0, 0, 50, 0));
+				}
+
 				window_texture.draw(line_border);
 				
 				// draw breakpoint marker
-				if (breakpoint_itr != cpu::breakpoints.end())
+				if (is_breakpoint)
 				{
 					window_texture.draw(breakpoint_marker);
 				}
@@ -449,16 +455,7 @@ namespace gameboy
 			// handle breakpoint
 			if (key == sf::Keyboard::F9)
 			{
-				auto itr = std::find(cpu::breakpoints.begin(), cpu::breakpoints.end(), active_addr);
-				
-				if (itr != cpu::breakpoints.end())
-				{
-					cpu::breakpoints.erase(itr);
-				}
-				else
-				{
-					cpu::breakpoints.push_back(active_addr);
-				}
+				cpu::toggle_breakpoint(active_addr);
 			}
 			else if (key == sf::Keyboard::F5)
 			{
@@ -484,7 +481,7 @@ namespace gameboy
 
 					if (sym.mnemonic.compare("CALL") == 0)
 					{
-						cpu::soft_breakpoints.push_back(find_next_instr(cpu::R.pc));
+						cpu::add_soft_breakpoint(find_next_instr(cpu::R.pc));
 						cpu::paused = false;
 						cpu::breakpoint_disable_one_instr = true;
 					}
@@ -39,6 +39,7 @@ namespace gameboy
 		sf::RectangleShape line_border;
 		sf::RectangleShape active_border;
 		sf::CircleShape breakpoint_marker;
+		sf::RectangleShape heat_marker;
 		
 		sf::RectangleShape goto_outer_border;
 		sf::RectangleShape goto_inner_border;
@@ -79,6 +80,8 @@ namespace gameboy
 			breakpoint_marker.setFillColor(sf::Color(255, 0, 0, 255));
 			breakpoint_marker.setRadius(5);
 
+			heat_marker.setSize(sf::Vector2f(MEM_LINE_COLUMN_WIDTH, LINE_HEIGHT));
+
 			title_text.setString("Memory Viewer");
 
 			bottom_text.setString("(Up / Down / Left / Right) Select Address\t(G) Goto Address\t(Enter) Modify Value");
@@ -159,6 +162,33 @@ namespace gameboy
 			window_texture.draw(goto_input_text);
 		}
 
+		// tint the bytes of a line by how often the cpu touched them. io registers are counted one by one, the rest of
+		// memory by page
+		void draw_heat(u16 addr, float y, u64 max_page_count, u64 max_io_count)
+		{
+			for (unsigned int j = 0; j < MEM_PER_LINE; j++)
+			{
+				u16 byte_addr = addr + j;
+				float heat;
+
+				if (byte_addr >= 0xFF00 && byte_addr < 0xFF80)
+				{
+					heat = memory_stats::get_heat(memory_stats::io_reads[byte_addr - 0xFF00] + memory_stats::io_writes[byte_addr - 0xFF00], max_io_count);
+				}
+				else
+				{
+					heat = memory_stats::get_heat(memory_stats::page_reads[byte_addr >> 8] + memory_stats::page_writes[byte_addr >> 8], max_page_count);
+				}
+
+				if (heat > 0.0f)
+				{
+					heat_marker.setFillColor(sf::Color(255, 0, 0, (u8)(heat * 160)));
+					heat_marker.setPosition((float)(MEM_LINE_COLUMN_XPOS + (j * (MEM_LINE_COLUMN_GAP))), y);
+					window_texture.draw(heat_marker);
+				}
+			}
+		}
+
 		void update()
 		{
 			if (cpu::paused && cpu::memory_breakpoint_last_addr != memory_breakpoint_last_addr)
@@ -179,6 +209,9 @@ namespace gameboy
 			line_border.setPosition(BORDER_SIZE, BORDER_SIZE + TITLEBAR_SIZE);
 			memory_text.setPosition(BORDER_SIZE + MEM_LINE_XPOS, BORDER_SIZE + TITLEBAR_SIZE);
 			
+			u64 max_page_count = memory_stats::get_max_page_count();
+			u64 max_io_count = memory_stats::get_max_io_count();
+
 			// draw foreground of each line
 			u8 color = 30;
 			for (unsigned int i = 0; i < LINE_COUNT; i++)
@@ -202,13 +235,18 @@ namespace gameboy
 
 				u16 addr = mem_start + (i * MEM_PER_LINE);
 
+				if (memory_stats::enabled)
+				{
+					draw_heat(addr, line_border.getPosition().y, max_page_count, max_io_count);
+				}
+
 				// draw memory line
 				memory_module::memory_map_object* map = memory_module::find_map(addr);
 
 				std::stringstream stream;
 				if (map->map_name.compare("ROMS") == 0)
 				{
-					stream << "ROM" << mbc::mbc_get_rom_bank_idx();
+					stream << "ROM" << mbc::controller->get_rom_bank_idx();
 				}
 				else
 				{
@@ -238,8 +276,7 @@ namespace gameboy
 					}
 
 					// check if memory breakpoint is set
-					auto memory_breakpoint_itr = std::find(cpu::memory_breakpoints.begin(), cpu::memory_breakpoints.end(), addr + j);
-					if (memory_breakpoint_itr != cpu::memory_breakpoints.end())
+					if (cpu::has_memory_breakpoint(addr + j))
 					{
 						sf::Vector2f pos = memory_text.getPosition();
 						pos.x = (float)(MEM_LINE_COLUMN_XPOS + (j * (MEM_LINE_COLUMN_GAP))) + MEM_BREAKPOINT_MARKER_OFFSET_X;
@@ -442,16 +479,7 @@ namespace gameboy
 			else if (key == sf::Keyboard::F9) // handle debugging. same as the handlers in disassembly
 			{
 				u16 addr = mem_start + (active_line * MEM_PER_LINE) + active_column;
-				auto itr = std::find(cpu::memory_breakpoints.begin(), cpu::memory_breakpoints.end(), addr);
-
-				if (itr != cpu::memory_breakpoints.end())
-				{
-					cpu::memory_breakpoints.erase(itr);
-				}
-				else
-				{
-					cpu::memory_breakpoints.push_back(addr);
-				}
+				cpu::toggle_memory_breakpoint(addr);
 			}
 			else if (key == sf::Keyboard::F5)
 			{
@@ -472,7 +500,7 @@ namespace gameboy
 
 					if (sym.mnemonic.compare("CALL") == 0)
 					{
-						cpu::soft_breakpoints.push_back(find_next_instr(cpu::R.pc));
+						cpu::add_soft_breakpoint(find_next_instr(cpu::R.pc));
 						cpu::paused = false;
 						cpu::breakpoint_disable_one_instr = true;
 					}
@@ -80,6 +80,16 @@ namespace gameboy
 			stream << "R.sp: " << WRITE_HEX_16(cpu::R.sp) << std::endl;
 			stream << "R.pc: " << WRITE_HEX_16(cpu::R.pc) << std::endl;
 
+			// start of the last idle loop skipped
+			if (idle_loop::last_detected_loop >= 0)
+			{
+				stream << "IDLE: " << WRITE_HEX_16(idle_loop::detected_loops[idle_loop::last_detected_loop].addr_start) << std::endl;
+			}
+			else
+			{
+				stream << "IDLE: -" << std::endl;
+			}
+
 			registers_text.setString(stream.str());
 
 			// draw to the window texture
@@ -113,7 +123,8 @@ namespace gameboy
 				y += FLAG_GAP;
 			}
 
-			// draw the gpu 
+			// draw the gpu. ly and stat are only brought up to date when read
+			gpu::catch_up(scheduler::cycles);
 			stream.str("");
 			stream << " LCDC: " << WRITE_HEX_8(*gpu::lcd_control) << std::endl;
 			stream << " LCDS: " << WRITE_HEX_8((0x80 | *gpu::lcd_status)) << std::endl;
@@ -122,7 +133,7 @@ namespace gameboy
 			stream << "   IE: " << WRITE_HEX_8(*cpu::interrupt_enable_flag) << std::endl;
 			stream << "   IF: " << WRITE_HEX_8(*cpu::interrupt_request_flag) << std::endl;
 			stream << "  IME: " << std::dec << (cpu::interrupt_master ? 1 : 0) << std::endl;
-			stream << "  CNT: " << std::dec << gpu::horz_cycle_count << (gpu::get_lcd_control_flag(gpu::FLAG_LCD_DISPLAY_ENABLED) == 0 ? " - " : "") << std::endl;
+			stream << "  CNT: " << std::dec << gpu::get_horz_cycle_count() << (gpu::get_lcd_control_flag(gpu::FLAG_LCD_DISPLAY_ENABLED) == 0 ? " - " : "") << std::endl;
 
 			gpu_registers_text.setString(stream.str());
 
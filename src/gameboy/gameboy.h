@@ -6,12 +6,14 @@
 #include "defines.h"
 
 #include "cpu.h"
+#include "idle_loop.h"
 #include "input.h"
 #include "gpu.h"
 #include "rom.h"
 #include "boot_rom.h"
 #include "debugger.h"
 #include "disassembler.h"
+#include "timer_trace.h"
 
 //#define USE_BOOT_ROM
 
@@ -36,7 +38,26 @@ namespace gameboy
 	std::map<sf::Keyboard::Key, input_binding> input_map;
 	std::list<unit_test> unit_test_list;
 	
-	int run_emulator_rom(std::string filename, bool show_window = true, s32 abort_pc = -1, std::string vram_checksum = "")
+	u32 get_state_checksum()
+	{
+		// fnv hash of the cpu registers and ram. used to compare runs across cpu builds
+		u32 hash = 2166136261;
+		u8* regs = (u8*)&cpu::R;
+
+		for (u32 i = 0; i < sizeof(cpu::R); i++)
+		{
+			hash = (hash ^ regs[i]) * 16777619;
+		}
+
+		for (u32 addr = 0x8000; addr < 0xE000; addr++)
+		{
+			hash = (hash ^ memory_module::read_memory(addr, true)) * 16777619;
+		}
+
+		return hash;
+	}
+
+	int run_emulator_rom(std::string filename, bool show_window = true, s32 abort_pc = -1, std::string vram_checksum = "", s32 benchmark_frames = -1)
 	{
 		// load and run the rom
 		rom rom(filename.c_str());
@@ -104,8 +125,12 @@ namespace gameboy
 
 		const u32 cycles_per_frame = cpu::cycles_per_sec / cpu::fps;
 		u32 cycle_count = 0;
+		u32 skipped_cycle_count = 0; // cycles fast forwarded while halted or stopped this frame
 		bool running = true;
 
+		s32 frame_count = 0;
+		auto start_time = std::chrono::high_resolution_clock::now();
+
 		while (running)
 		{
 			// poll for window events
@@ -132,6 +157,7 @@ namespace gameboy
 							{
 								cpu::reset();
 								gpu::reset();
+								idle_loop::reset();
 								cycle_count = 0;
 							}
 							else if (event.key.code == sf::Keyboard::F2)
@@ -182,12 +208,45 @@ namespace gameboy
 				}
 			}
 			
+			skipped_cycle_count = 0;
+			idle_loop::new_frame();
+
 			while (cycle_count < cycles_per_frame)
 			{
-				// update the cpu emulation
-				u8 cpu_cycles = cpu::check_interrupts();
-				cpu_cycles += cpu::execute_opcode();
+				if (cpu::stop)
+				{
+					// the clock is stopped until a button is pressed. nothing runs for the rest of the frame
+					skipped_cycle_count += cycles_per_frame - cycle_count;
+					cycle_count = cycles_per_frame;
+					break;
+				}
+
+				if (cpu::halt)
+				{
+					// jump to the next timer or lcd event instead of stepping halt
+					u32 skipped_cycles = cpu::fast_forward_halt(cycles_per_frame - cycle_count);
+					skipped_cycle_count += skipped_cycles;
+					cycle_count += skipped_cycles;
+
+					if (skipped_cycles > 0)
+					{
+						continue;
+					}
+				}
+
+				// update the cpu emulation. runs the cached block at pc up to the end of the frame
+				u32 cpu_cycles = cpu::check_interrupts();
+				u16 opcode_pc = cpu::R.pc;
+				cpu_cycles += cpu::execute_block((s32)(cycles_per_frame - cycle_count - cpu_cycles), opcode_pc, abort_pc);
 				cycle_count += cpu_cycles;
+
+				if (cpu::R.pc <= opcode_pc)
+				{
+					// backward jump. skip ahead if it closes an idle loop
+					u32 skipped_cycles = idle_loop::on_backward_branch(opcode_pc, cycle_count, cycles_per_frame);
+					skipped_cycle_count += skipped_cycles;
+					cycle_count += skipped_cycles;
+				}
 				
 				// used for unit testing
 				if (cpu::R.pc == abort_pc)
@@ -222,6 +281,23 @@ namespace gameboy
 			{
 				// once we have passed cycles per frame reset cycle count
 				cycle_count -= cycles_per_frame;
+
+				save_ram::update();
+			}
+
+			// used for benchmarking. run a fixed number of frames as fast as possible
+			if (benchmark_frames > 0 && (++frame_count >= benchmark_frames || !cpu::running))
+			{
+				gpu::wait_frames_drawn(gpu::frames_captured);
+
+				std::chrono::duration<double, std::milli> delta = std::chrono::high_resolution_clock::now() - start_time;
+				double emulated_ms = frame_count * 1000.0 / cpu::fps;
+				double draw_ms = gpu::draw_nanoseconds / 1000000.0;
+
+				// drawing overlaps the cpu with the render thread on another core. the time is then bounded by the longer
+				// of the two
+				printf("Frames: %d Time: %.2f ms Speed: %.2fx Draw: %.2f ms Checksum: 0x%08X\n", frame_count, delta.count(), emulated_ms / delta.count(), draw_ms, get_state_checksum());
+				return 0;
 			}
 
 			if (is_window_enabled)
@@ -234,6 +310,7 @@ namespace gameboy
 			{
 				if (is_window_enabled)
 				{
+					gpu::present_framebuffer();
 					framebuffer_texture.update(gpu::framebuffer, gpu::width, gpu::height, 0, 0);
 				}
 
@@ -256,6 +333,7 @@ namespace gameboy
 				// show profliler stats
 				std::stringstream stream;
 				stream << "FPS: " << fps << "\n";
+				stream << "Skipped: " << skipped_cycle_count << " cycles (" << (skipped_cycle_count * 100 / cycles_per_frame) << "%)\n";
 
 				fps_text.setString(stream.str());
 				window.draw(fps_text);
@@ -297,6 +375,50 @@ namespace gameboy
 		return 0;
 	}
 
+	// fnv hash of each drawn frame, in the order the frames were drawn
+	std::vector<u32> drawn_frame_hashes;
+
+	void hash_drawn_frame(const u8* framebuffer_indexed)
+	{
+		u32 hash = 2166136261;
+
+		for (u32 i = 0; i < gpu::width * gpu::height; i++)
+		{
+			hash = (hash ^ framebuffer_indexed[i]) * 16777619;
+		}
+
+		drawn_frame_hashes.push_back(hash);
+	}
+
+	// run the rom headless with the frames drawn on the cpu thread, then again with the render thread. returns 0 when
+	// every frame is drawn the same
+	int run_render_thread_test(std::string filename, s32 frames)
+	{
+		// both passes start from fresh zeroed cartridge ram. with the .sav file the second pass would start from the
+		// ram the first one left behind
+		memory_module::disable_battery_saves();
+
+		gpu::disable_render_thread();
+		gpu::frame_drawn_callback = hash_drawn_frame;
+
+		drawn_frame_hashes.clear();
+		run_emulator_rom(filename, false, -1, "", frames);
+		std::vector<u32> sync_hashes = drawn_frame_hashes;
+
+		// the render thread is joined with every frame drawn
+		drawn_frame_hashes.clear();
+		gpu::enable_render_thread();
+		run_emulator_rom(filename, false, -1, "", frames);
+		gpu::disable_render_thread();
+
+		gpu::frame_drawn_callback = nullptr;
+
+		bool match = !sync_hashes.empty() && sync_hashes == drawn_frame_hashes;
+		printf("Render thread test: %u frames drawn Match: %s\n", (u32)sync_hashes.size(), match ? "yes" : "no");
+
+		return match ? 0 : 1;
+	}
+
 	int run_emulator(int argc, const char* argv[])
 	{
 		// do some arg parsing
@@ -306,6 +428,13 @@ namespace gameboy
 		parser.add_argument("-u", "--unit_test", "Unit test the rom", false);
 		parser.add_argument("-p", "--unit_test_abortpc", "Unit test abort pc (required with unit_test)", false);
 		parser.add_argument("-c", "--unit_test_check", "Unit test check (required with unit_test)", false);
+		parser.add_argument("-b", "--benchmark", "Run the rom headless for a number of frames and print timing", false);
+		parser.add_argument("-j", "--jit", "Translate hot code blocks to native code", false);
+		parser.add_argument("-t", "--render_thread", "Draw frames on a render thread while the cpu runs the next frame", false);
+		parser.add_argument("-m", "--memory_stats", "Write memory access counts to a .csv or .json file at exit (needs MEMORY_STATS)", false);
+		parser.add_argument("-k", "--kernel_benchmark", "Time the scalar and simd scanline kernels for a number of lines", false);
+		parser.add_argument("-e", "--render_thread_test", "Draw n frames on the cpu thread and on the render thread and compare them", false);
+		parser.add_argument("-i", "--timer_trace", "Compare the divider and timer against a per cycle model over a random trace of n steps", false);
 		parser.add_argument("-r", "--rom_file", "Rom file", true);
 
 		parser.enable_help();
@@ -321,10 +450,32 @@ namespace gameboy
 			parser.print_help();
 			return 0;
 		}
-		else if (parser.exists("d"))
+
+		if (parser.exists("j"))
+		{
+			cpu::enable_jit();
+		}
+
+		if (parser.exists("t"))
+		{
+			gpu::enable_render_thread();
+		}
+
+		if (parser.exists("m"))
+		{
+			if (!memory_stats::enabled)
+			{
+				printf("Memory stats are compiled out. define MEMORY_STATS in memory_stats.h\n");
+			}
+
+			memory_stats::dump_filename = parser.get<std::string>("m");
+		}
+
+		if (parser.exists("d"))
 		{
 			std::string rom_filename = parser.get<std::string>("r");
 			rom rom(rom_filename.c_str());
+			memory_module::disable_battery_saves();
 			memory_module::initialize(nullptr, &rom);
 
 			// export disassembler to file and close
@@ -335,6 +486,35 @@ namespace gameboy
 
 			return 0;
 		}
+		else if (parser.exists("k"))
+		{
+			u32 lines = std::stoi(parser.get<std::string>("k"));
+
+			return scanline_kernels::run_benchmark(lines);
+		}
+		else if (parser.exists("e"))
+		{
+			std::string rom_filename = parser.get<std::string>("r");
+			s32 frames = std::stoi(parser.get<std::string>("e"));
+
+			memory_module::disable_warnings();
+
+			return run_render_thread_test(rom_filename, frames);
+		}
+		else if (parser.exists("i"))
+		{
+			std::string rom_filename = parser.get<std::string>("r");
+			u32 steps = std::stoi(parser.get<std::string>("i"));
+
+			rom rom(rom_filename.c_str());
+			memory_module::disable_warnings();
+			memory_module::disable_battery_saves();
+			memory_module::initialize(nullptr, &rom);
+			cpu::initialize();
+			gpu::initialize();
+
+			return timer_trace::run(steps);
+		}
 		else if (parser.exists("a"))
 		{
 			// not supported
@@ -353,11 +533,24 @@ namespace gameboy
 			s32 abort_pc = std::stoi(parser.get<std::string>("p"), 0, 16);
 
 			memory_module::disable_warnings();
+			memory_module::disable_battery_saves();
 
 			int ret = run_emulator_rom(rom_filename, false, abort_pc, checksum);
 
 			return ret;
 		}
+		else if (parser.exists("b"))
+		{
+			std::string rom_filename = parser.get<std::string>("r");
+			s32 frames = std::stoi(parser.get<std::string>("b"));
+
+			memory_module::disable_warnings();
+			memory_module::disable_battery_saves();
+
+			int ret = run_emulator_rom(rom_filename, false, -1, "", frames);
+
+			return ret;
+		}
 		else
 		{
 			std::string rom_filename = parser.get<std::string>("r");
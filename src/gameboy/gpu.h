@@ -2,7 +2,16 @@
 
 #include "defines.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include "gameboy\memory_module.h"
+#include "gameboy\scheduler.h"
+#include "gameboy\tile_cache.h"
+#include "gameboy\scanline_kernels.h"
 
 namespace gameboy
 {
@@ -19,16 +28,154 @@ namespace gameboy
 		u8* windowX = 0;
 		u8* windowY = 0;
 		u8* palette_bg = 0;
-		u8* sprite_attr = 0;
 
 		const u8 width = 160;
 		const u8 height = 144;
-		u8 framebuffer[width * height * 4];
-		bool lcd_enabling = false;
+		u8 framebuffer[width * height * 4]; // rgba of the last drawn frame, converted once per presented frame
+		u8 bg_line[width]; // background and window palette indices of the current line, for sprite priority
+
+		// sprite pixels of the current line, 8 pixels of room each side for sprites clipped at the edges. indices are 0
+		// where no sprite is opaque
+		u8 obj_indices[width + 16];
+		u8 obj_shades[width + 16];
+		u8 obj_behind[width + 16];
+
+		// the oam scan. sprites on each line, up to 10, in priority order. built again when the lcd's oam or the sprite
+		// height changes
+		const u8 max_line_sprites = 10;
+		u8 line_sprites[height][max_line_sprites];
+		u8 line_sprite_count[height];
+		bool line_sprites_dirty = true;
+		u8 line_sprites_height = 0;
+
+		// the window draws its own lines. its line counter only moves on lines the window is drawn
+		bool window_triggered = false;
+		u8 window_line = 0;
+
+		// palette registers as a palette index to shade table. rebuilt when bgp, obp0 or obp1 is written
+		enum PALETTE_REGISTER
+		{
+			PALETTE_BG = 0,
+			PALETTE_OBJ0,
+			PALETTE_OBJ1,
+			PALETTE_COUNT
+		};
+
+		u8 palette_shades[PALETTE_COUNT][4];
+		u32 shade_pixels[4]; // framebuffer pixel of each shade
+
+		// the registers a line is drawn with. lines are captured as the lcd passes them and the frame is drawn in one
+		// pass after the last visible line
+		struct line_registers
+		{
+			u8 lcd_control;
+			u8 scrollX;
+			u8 scrollY;
+			u8 windowX;
+			u8 windowY;
+			bool sprites_hidden; // oam is on the dma bus
+			u8 shades[PALETTE_COUNT][4];
+		};
+
+		// vram and oam writes made while a frame is captured. replayed in front of the line they were made before
+		struct lcd_memory_write
+		{
+			u16 addr;
+			u8 line;
+			u8 value;
+		};
+
+		// everything a frame is drawn from. vram and oam as the frame started, the registers of each line and the writes
+		// made during the frame. there are two, so the cpu captures the next frame while the render thread draws one.
+		// each is drawn to its own framebuffer, so the last drawn frame is presented while the next one is drawn
+		struct frame_job
+		{
+			line_registers lines[height];
+			u8 vram[0x2000];
+			u8 oam[0xA0];
+			std::vector<lcd_memory_write> writes;
+			u8 framebuffer_indexed[width * height]; // shades 0 - 3 as the lcd draws them
+		};
+
+		frame_job frame_jobs[2];
+		u8 frame_line_count = 0; // lines captured this frame
+		bool oam_scan_dma_active = false; // dma state when the current line scanned oam
+		std::atomic<u32> frames_captured(0);
+		std::atomic<u32> frames_drawn(0);
+
+		// vram and oam as of the line being drawn and the framebuffer of the frame being drawn. only used by the code
+		// drawing frames
+		u8 lcd_vram[0x2000];
+		u8 lcd_oam[0xA0];
+		u8* draw_framebuffer = nullptr;
+
+		// time spent drawing frames and a hook called with each drawn frame. also run on the render thread, so only read
+		// or changed with every captured frame drawn
+		u64 draw_nanoseconds = 0;
+		void(*frame_drawn_callback)(const u8* framebuffer_indexed) = nullptr;
+
+		// draws the captured frames while the cpu runs on. frames are handed over through the job double buffer and
+		// the frame counters. the mutex is only held to sleep and wake the thread
+		std::thread render_thread;
+		std::mutex render_mutex;
+		std::condition_variable render_condition;
+		bool render_thread_enabled = false;
+		bool render_thread_stop = false;
+
+		// what an lcd step did
+		enum LCD_STEP
+		{
+			STEP_LINE_INC = 0x1, // moved to the next scanline. the line left is captured
+			STEP_MODE = 0x2, // switched to a new mode
+		};
+
+		// where the lcd is in its frame. ly and the mode bits live in their registers and are copied in before a
+		// step. steps only change the position, so a copy can be run ahead to find the next step that matters
+		struct lcd_position
+		{
+			u64 horz_deadline; // scheduler cycle the current lcd step ends on
+			s32 horz_cycle_count;
+			u8 mode;
+			u8 line;
+			bool scanline_inc;
+			bool lcd_enabling;
+			u8 oam_access;
+			u8 vram_access;
+			u8 steps; // LCD_STEP flags of the last step
+		};
+
+		// ly, stat and the vram and oam access are worked out from the cycle counter. the steps between events are
+		// run when something reads or changes the lcd state, each on the cycle it was due
+		// about 40 lines. the planned steps are searched again on a register write, so a longer plan costs more than the
+		// few wake ups it saves
+		const u32 max_planned_steps = 256;
+
+		lcd_position lcd;
+		u64 lcd_step_cycles = scheduler::event_none; // cycle the next step is due
+		bool lcd_registers_written = false;
+
+		// the positions after the steps run ahead to find the lcd event. catching up replays them instead of running the
+		// steps again. they only depend on the position, so they are kept until ly, the mode or the lcd enable are
+		// changed from outside. the ones from lcd_plan_next on are still to come, the first due on lcd_step_cycles
+		lcd_position lcd_plan[max_planned_steps];
+		u32 lcd_plan_count = 0;
+		u32 lcd_plan_next = 0;
+
+		inline void drop_lcd_plan()
+		{
+			lcd_plan_count = 0;
+			lcd_plan_next = 0;
+		}
+
 		bool lcd_enabled = false;
-		bool scanline_inc = false;
-		s32 horz_cycle_count = 0;
 		bool vblank_occurred = false;
+
+		void update_lcd_event(u64 event_cycles);
+		void catch_up(u64 until_cycles);
+		void lcd_register_written();
+		u32 get_shade_color(u8 shade);
+		void palette_written(u16 addr, u8 value);
+		void wait_frames_drawn(u32 count);
 				
 		// set and get lcd control flag helpers
 		inline void set_lcd_control_flag(u8 flag)
@@ -48,6 +195,11 @@ namespace gameboy
 			return ((*lcd_control & (1 << flag)) >> flag);
 		}
 
+		inline u8 get_line_control_flag(const line_registers& regs, u8 flag)
+		{
+			return ((regs.lcd_control & (1 << flag)) >> flag);
+		}
+
 		inline void clear_all_lcd_control_flags()
 		{
 			*lcd_control = 0x0;
@@ -154,12 +306,47 @@ namespace gameboy
 			FLAG_SPRITE_PRIORITY,
 		};
 
+		// white in both jobs. only with every captured frame drawn
+		void clear_framebuffers()
+		{
+			for (frame_job& job : frame_jobs)
+			{
+				memset(job.framebuffer_indexed, 0x0, sizeof(job.framebuffer_indexed));
+			}
+		}
+
 		int reset()
 		{
-			horz_cycle_count = 0;
-			lcd_enabling = false;
+			memset(&lcd, 0x0, sizeof(lcd));
+			lcd_step_cycles = scheduler::event_none;
+			lcd_registers_written = false;
+			drop_lcd_plan();
 			lcd_enabled = false;
+			oam_scan_dma_active = false;
+			scheduler::set_lazy_cycles(scheduler::LAZY_LCD, lcd_step_cycles);
+			wait_frames_drawn(frames_captured);
+			clear_framebuffers();
 			memset(framebuffer, 0x0, sizeof(framebuffer));
+			draw_nanoseconds = 0;
+			memset(lcd_vram, 0x0, sizeof(lcd_vram));
+			memset(lcd_oam, 0x0, sizeof(lcd_oam));
+			line_sprites_dirty = true;
+			frame_line_count = 0;
+			tile_cache::reset();
+
+			for (u8 i = 0; i < 4; i++)
+			{
+				shade_pixels[i] = scanline_kernels::get_pixel(get_shade_color(i));
+			}
+
+			for (u16 addr = 0xFF47; addr <= 0xFF49; addr++)
+			{
+				palette_written(addr, memory_module::read_memory(addr, true));
+			}
+
+			scheduler::set_event_handler(scheduler::EVENT_LCD, update_lcd_event);
+			scheduler::set_lazy_handler(scheduler::LAZY_LCD, catch_up);
+			lcd_register_written();
 			
 			return 0;
 		}
@@ -176,23 +363,20 @@ namespace gameboy
 			windowY = memory_module::get_memory(0xFF4A, true);
 			windowX = memory_module::get_memory(0xFF4B, true);
 			palette_bg = memory_module::get_memory(0xFF47, true);
-			sprite_attr = memory_module::get_memory(0xFE00, true);
+			tile_cache::vram = lcd_vram;
 
 			reset();
 
 			return 0;
 		}
 
-		u32 get_palette_color(u8 palette_color, u8 palette)
+		u32 get_shade_color(u8 shade)
 		{
-			palette >>= (palette_color << 1);
-			palette &= 0x3;
-
 			u32 color = 0xFF; // alpha
 
 			if (green_palette)
 			{
-				switch (palette)
+				switch (shade)
 				{
 				case 0x00: // white
 					color = 0xE0F8D0FF;
@@ -210,7 +394,7 @@ namespace gameboy
 			}
 			else
 			{
-				switch (palette)
+				switch (shade)
 				{
 				case 0x00: // white
 					color = 0xFFFFFFFF;
@@ -230,263 +414,455 @@ namespace gameboy
 			return color;
 		}
 
+		u32 get_palette_color(u8 palette_color, u8 palette)
+		{
+			return get_shade_color((palette >> (palette_color << 1)) & 0x3);
+		}
+
+		void palette_written(u16 addr, u8 value)
+		{
+			u8* shades = palette_shades[addr - 0xFF47];
+
+			for (u8 i = 0; i < 4; i++)
+			{
+				shades[i] = (value >> (i << 1)) & 0x3;
+			}
+		}
+
+		// convert the last drawn frame to rgba. called when the frame is presented. the render thread may still be drawing
+		// the frame captured last into the other job, so only the one before it is waited for
+		void present_framebuffer()
+		{
+			wait_frames_drawn(frames_captured - 1);
+
+			u32 drawn = frames_drawn;
+			scanline_kernels::apply_palette(framebuffer, frame_jobs[(drawn - 1) % 2].framebuffer_indexed, width * height, shade_pixels);
+		}
+
 		u32 get_palette_color(u8 palette_color)
 		{
 			return get_palette_color(palette_color, memory_module::read_memory(0xFF47, true));
 		}
 
-		int draw_scanline()
+		// copy the 21 tile rows from a 32 tile map row starting at tileX
+		void fetch_tile_rows(const line_registers& regs, bool high_tilemap, u8 mapY, u8 tileX, u8* tile_rows)
 		{
-			if (get_lcd_control_flag(FLAG_LCD_DISPLAY_ENABLED) == false)
+			// tilemap starting location. tilemap is 32 x 32 bytes that map to a tile
+			const u8* tilemap = &lcd_vram[(high_tilemap ? 0x9C00 : 0x9800) - 0x8000] + (mapY / 8) * 32; // map is 32 tiles wide
+			u8 tileYPixel = mapY % 8; // the row of the specific tile the scanline is on
+
+			// tile data at 0x8800 is addressed with a signed tile id around tile 256
+			bool signed_tile_id = (get_line_control_flag(regs, FLAG_BG_WINDOW_TILE_DISPLAY_SELECT) == 0);
+
+			for (u32 i = 0; i < 21; i++)
+			{
+				u8 tileId = tilemap[(tileX + i) % 32];
+				u32 tile = (signed_tile_id ? 256 + (s8)tileId : tileId);
+				memcpy(&tile_rows[i * 8], tile_cache::get_row(tile, tileYPixel), 8);
+			}
+		}
+
+		int draw_scanline(u8 line, const line_registers& regs)
+		{
+			if (get_line_control_flag(regs, FLAG_LCD_DISPLAY_ENABLED) == false)
 			{
 				return 0;
 			}
 
-			if (get_lcd_control_flag(FLAG_WINDOW_DISPLAY_ENABLED))
+			if (regs.windowY == line)
 			{
-//				warning_assert("window tilemap not implemented yet");
+				window_triggered = true;
 			}
 
-			// only doing background. but will need to merge this with window
-			if (get_lcd_control_flag(FLAG_BG_DISPLAY_ENABLED)) 
+			// background and window are both white with the background off
+			if (get_line_control_flag(regs, FLAG_BG_DISPLAY_ENABLED) == false)
 			{
-				// tilemap starting location. tilemap is 32 x 32 bytes that map to a tile
-				u16 tilemapAddr = 0x9800;
-				if (get_lcd_control_flag(FLAG_BG_TILEMAP_DISPLAY_SELECT))
-				{
-					tilemapAddr = 0x9C00;
-				}
+				memset(bg_line, 0x0, width);
+				memset(&draw_framebuffer[line * width], 0x0, width);
+				return 0;
+			}
 
-				s32 tilesetOffset = 128; // offset depending on tileset used
-				s32 tileSize = 16; // each tile is 16 bytes. 2 x 8 rows of a tile
-				u16 tilesetAddr = 0x8800; // addr of tileset
-				if (get_lcd_control_flag(FLAG_BG_WINDOW_TILE_DISPLAY_SELECT))
-				{
-					tilesetAddr = 0x8000;
-					tilesetOffset = 0;
-				}
+			u8 tile_rows[21 * 8];
+
+			// background from the scroll offset
+			fetch_tile_rows(regs, get_line_control_flag(regs, FLAG_BG_TILEMAP_DISPLAY_SELECT) != 0, regs.scrollY + line, regs.scrollX / 8, tile_rows);
+			memcpy(bg_line, tile_rows + (regs.scrollX % 8), width);
+
+			// window over the background from wx - 7 to the right edge
+			if (get_line_control_flag(regs, FLAG_WINDOW_DISPLAY_ENABLED) && window_triggered && regs.windowX <= width + 6)
+			{
+				s16 windowX = regs.windowX - 7;
+				u8 screenX = (windowX < 0 ? 0 : (u8)windowX);
+				u8 firstPixel = (windowX < 0 ? (u8)-windowX : 0);
+
+				fetch_tile_rows(regs, get_line_control_flag(regs, FLAG_WINDOW_TILEMAP_DISPLAY_SELECT) != 0, window_line, 0, tile_rows);
+				memcpy(&bg_line[screenX], tile_rows + firstPixel, width - screenX);
+
+				window_line++;
+			}
+
+			scanline_kernels::apply_shades(&draw_framebuffer[line * width], bg_line, width, regs.shades[PALETTE_BG]);
+
+			return 0;
+		}
+
+		// the first 10 sprites in oam on each line. on screen the sprite with the smaller x is on top and oam order
+		// breaks ties
+		void scan_oam(u8 spriteHeight)
+		{
+			memset(line_sprite_count, 0x0, sizeof(line_sprite_count));
 
-				u8 yPos = *scrollY + *scanline;
-				u32 tileY = (yPos / 8) * 32; // calc tile offset based on yPos. map is 32 tiles wide
-				u8 tileYPixel = yPos % 8; // the row of the specific tile the scanline is on
+			for (u8 sprite = 0; sprite < 40; sprite++) // oam has room for 40 sprites with 4 bytes attr each sprite
+			{
+				s16 yPos = lcd_oam[sprite * 4] - 16;
 
-				// draw the 160 horz pixels
-				for (u32 pixel = 0; pixel < 160; pixel++)
+				for (s16 line = std::max<s16>(yPos, 0); line < yPos + spriteHeight && line < height; line++)
 				{
-					u8 xPos = *scrollX + pixel;
-					u32 tileX = xPos / 8; // calc tile offset base on xPos
-					u8 tileXPixel = xPos % 8; // the column of the speific tile to draw
-					s16 tileId = 0;
-					
-					if (tilesetOffset != 0) // its a signed value
+					u8& count = line_sprite_count[line];
+					if (count < max_line_sprites)
 					{
-						tileId = (s8)memory_module::read_memory(tilemapAddr + tileX + tileY, true);
-						tileId += tilesetOffset; // apply offset to the id
-					}
-					else
-					{
-						tileId = memory_module::read_memory(tilemapAddr + tileX + tileY, true);
+						line_sprites[line][count++] = sprite;
 					}
+				}
+			}
+
+			for (u8 line = 0; line < height; line++)
+			{
+				u8* sprites = line_sprites[line];
 
-					// we have the tile id. lets draw pixel
-					u8* tileset = memory_module::get_memory(tilesetAddr + (tileId * tileSize) + (tileYPixel * 2), true);
-					u8 dataA = tileset[0];
-					u8 dataB = tileset[1];
-					u8 bit = 7 - tileXPixel; // the bits and pixels are inversed
-					u8 palette_color = ((dataA & (1 << bit)) >> bit) | (((dataB & (1 << bit)) >> bit) << 1);
+				for (u8 i = 1; i < line_sprite_count[line]; i++)
+				{
+					u8 sprite = sprites[i];
+					u8 j = i;
 
-					u32 color = gpu::get_palette_color(palette_color);
+					for (; j > 0 && lcd_oam[sprites[j - 1] * 4 + 1] > lcd_oam[sprite * 4 + 1]; j--)
+					{
+						sprites[j] = sprites[j - 1];
+					}
 
-					u32 pixelPos = ((*scanline) * 160 + pixel) * 4; // the pixel we are drawing * 4 bytes per pixel
-					framebuffer[pixelPos++] = (color >> 24) & 0xFF;
-					framebuffer[pixelPos++] = (color >> 16) & 0xFF;
-					framebuffer[pixelPos++] = (color >> 8) & 0xFF;
-					framebuffer[pixelPos++] = 0xFF;
+					sprites[j] = sprite;
 				}
 			}
 
-			return 0;
+			line_sprites_dirty = false;
+			line_sprites_height = spriteHeight;
 		}
 
-		int draw_sprites()
+		int draw_sprites(u8 line, const line_registers& regs)
 		{
-			if (get_lcd_control_flag(FLAG_LCD_DISPLAY_ENABLED) == false)
+			if (get_line_control_flag(regs, FLAG_LCD_DISPLAY_ENABLED) == false || get_line_control_flag(regs, FLAG_OBJ_DISPLAY_ENABLED) == false)
 			{
 				return 0;
 			}
 
-			u8 spriteHeight = (get_lcd_control_flag(FLAG_OBJ_SIZE) == 0 ? 8 : 16);
-			u8* spritePtr = sprite_attr;
-			u8 sprite_count = 0;
-			s32 tileSize = 16; // each tile is 16 bytes. 2 x 8 rows of a tile
+			// oam is on the dma bus during a transfer. the lcd reads 0xFF, which puts every sprite off screen
+			if (regs.sprites_hidden)
+			{
+				return 0;
+			}
 
-			while (sprite_count < 40) // oam has room for 40 sprites with 4 bytes attr each sprite
+			u8 spriteHeight = (get_line_control_flag(regs, FLAG_OBJ_SIZE) == 0 ? 8 : 16);
+			if (line_sprites_dirty || line_sprites_height != spriteHeight)
 			{
-				sprite_count++;
-				u8 yPos = *(spritePtr++) - 16;
-				u8 xPos = *(spritePtr++) - 8;
-				u8 tileId = *(spritePtr++);
-				u8 attr = *(spritePtr++);
+				scan_oam(spriteHeight);
+			}
 
-				// check if scanline within y_min y_max
-				if (*scanline >= yPos && *scanline < yPos + spriteHeight)
+			u8 count = line_sprite_count[line];
+			if (count == 0)
+			{
+				return 0;
+			}
+
+			memset(obj_indices, 0x0, sizeof(obj_indices));
+
+			// merge in priority order. a pixel a sprite already took stays with that sprite
+			for (u8 i = 0; i < count; i++)
+			{
+				const u8* sprite = &lcd_oam[line_sprites[line][i] * 4];
+				u8 yPos = sprite[0];
+				u8 xPos = sprite[1]; // screen x + 8
+				u8 tileId = sprite[2];
+				u8 attr = sprite[3];
+
+				// off screen sprites still count to the 10 on the line
+				if (xPos == 0 || xPos >= width + 8)
 				{
-					s16 tileY = *scanline - yPos;
+					continue;
+				}
 
-					if (get_sprite_attribute(attr, FLAG_SPRITE_FLIP_Y))
-					{
-						tileY -= spriteHeight;
-						tileY *= -1;
-					}
+				u8 tileY = line + 16 - yPos;
 
-					u8* tileset = memory_module::get_memory(0x8000 + (tileId * tileSize) + (tileY * 2));
-					u8 dataA = tileset[0];
-					u8 dataB = tileset[1];
+				if (get_sprite_attribute(attr, FLAG_SPRITE_FLIP_Y))
+				{
+					tileY = spriteHeight - 1 - tileY;
+				}
 
-					// render the 8 pixels of the tiles scanline
-					for (u8 pixel = 0; pixel < 8; pixel++)
-					{
-						s8 bit = 7 - pixel;
-
-						if (get_sprite_attribute(attr, FLAG_SPRITE_FLIP_X))
-						{
-							bit -= 7;
-							bit *= -1;
-						}
-
-						u8 palette_color = ((dataA & (1 << bit)) >> bit) | (((dataB & (1 << bit)) >> bit) << 1);
-
-						if (palette_color == 0x0)
-						{
-							// pixel is transparent
-							continue;
-						}
-
-						u8 palette = get_sprite_attribute(attr, FLAG_SPRITE_PALETTE);
-
-						if (palette == 0)
-						{
-							palette = memory_module::read_memory(0xFF48, true);
-						}
-						else
-						{
-							palette = memory_module::read_memory(0xFF49, true);
-						}
-
-						u32 color = gpu::get_palette_color(palette_color, palette);
-
-						u32 pixelPos = ((*scanline) * 160 + xPos + pixel) * 4; // the pixel we are drawing * 4 bytes per pixel
-						framebuffer[pixelPos++] = (color >> 24) & 0xFF;
-						framebuffer[pixelPos++] = (color >> 16) & 0xFF;
-						framebuffer[pixelPos++] = (color >> 8) & 0xFF;
-						framebuffer[pixelPos++] = 0xFF;
-					}
+				// tall sprites are an even and odd tile pair. bit 0 of the tile id is ignored
+				if (spriteHeight == 16)
+				{
+					tileId = (tileId & 0xFE) | (tileY / 8);
 				}
+
+				const u8* tile_row = tile_cache::get_row(tileId, tileY % 8, get_sprite_attribute(attr, FLAG_SPRITE_FLIP_X) != 0);
+				const u8* shades = regs.shades[get_sprite_attribute(attr, FLAG_SPRITE_PALETTE) == 0 ? PALETTE_OBJ0 : PALETTE_OBJ1];
+				bool behind_bg = (get_sprite_attribute(attr, FLAG_SPRITE_PRIORITY) != 0);
+
+				scanline_kernels::merge_sprite_row(&obj_indices[xPos], &obj_shades[xPos], &obj_behind[xPos], tile_row, shades, behind_bg);
 			}
 
+			scanline_kernels::composite_sprites(&draw_framebuffer[line * width], bg_line, &obj_indices[8], &obj_shades[8], &obj_behind[8], width);
+
 			return 0;
 		}
 
-		int increment_scanline()
+		inline void set_lcd_memory(u16 addr, u8 value)
 		{
-			if (*scanline < 144)
+			if (addr >= 0xFE00)
 			{
-				draw_scanline();
-				draw_sprites();
+				lcd_oam[addr - 0xFE00] = value;
+				line_sprites_dirty = true;
+				return;
 			}
 
-			(*scanline)++; // inc scanline interrupt
+			lcd_vram[addr - 0x8000] = value;
 
-			if (*coincidence_scanline == *scanline)
+			if (addr < tile_cache::tile_data_end)
 			{
-				if (get_lcd_interrupt_flag(FLAG_COINCIDENCE))
-				{
-					cpu::set_request_interrupt_flag(cpu::INTERRUPT_LCD);
-				}
+				tile_cache::invalidate(addr);
 			}
-
-			return 0;
 		}
 
-		int switch_lcd_mode(u8 lcd_mode)
+		void draw_frame(frame_job& job)
 		{
-			set_lcd_status_mode(lcd_mode);
-			scanline_inc = false;
+			auto start_time = std::chrono::high_resolution_clock::now();
 
-			switch (lcd_mode)
+			// tiles that changed since the last frame are decoded again
+			for (u32 tile = 0; tile < tile_cache::tile_count; tile++)
 			{
-			case MODE_HBLANK:
-				memory_module::set_memory_access(memory_module::MEMORY_OAM, 0x3);
-				memory_module::set_memory_access(memory_module::MEMORY_VRAM, 0x3);
-
-				if (get_lcd_interrupt_flag(FLAG_HBLANK))
+				if (memcmp(&job.vram[tile * 16], &lcd_vram[tile * 16], 16) != 0)
 				{
-					cpu::set_request_interrupt_flag(cpu::INTERRUPT_LCD);
+					tile_cache::invalidate(0x8000 + tile * 16);
 				}
+			}
 
-				horz_cycle_count += 204;
-				break;
-			case MODE_VBLANK:
-				memory_module::set_memory_access(memory_module::MEMORY_OAM, 0x3);
-				memory_module::set_memory_access(memory_module::MEMORY_VRAM, 0x3);
+			if (memcmp(job.oam, lcd_oam, sizeof(lcd_oam)) != 0)
+			{
+				line_sprites_dirty = true;
+			}
 
-				// draw the scan line
-				draw_scanline();
-				draw_sprites();
+			memcpy(lcd_vram, job.vram, sizeof(lcd_vram));
+			memcpy(lcd_oam, job.oam, sizeof(lcd_oam));
 
-				cpu::set_request_interrupt_flag(cpu::INTERRUPT_VBLANK);
+			draw_framebuffer = job.framebuffer_indexed;
+			window_triggered = false;
+			window_line = 0;
 
-				if (get_lcd_interrupt_flag(FLAG_VBLANK))
+			size_t next_write = 0;
+
+			for (u8 line = 0; line < height; line++)
+			{
+				for (; next_write < job.writes.size() && job.writes[next_write].line <= line; next_write++)
 				{
-					cpu::set_request_interrupt_flag(cpu::INTERRUPT_LCD);
+					set_lcd_memory(job.writes[next_write].addr, job.writes[next_write].value);
 				}
 
-				horz_cycle_count += 456;
-				vblank_occurred = true;
-				break;
-			case MODE_OAM_ACCESS:
-				memory_module::set_memory_access(memory_module::MEMORY_OAM, 0);
+				draw_scanline(line, job.lines[line]);
+				draw_sprites(line, job.lines[line]);
+			}
+
+			draw_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start_time).count();
+
+			if (frame_drawn_callback)
+			{
+				frame_drawn_callback(job.framebuffer_indexed);
+			}
+		}
 
-				if (get_lcd_interrupt_flag(FLAG_OAM_ACCESS))
+		void render_thread_func()
+		{
+			std::unique_lock<std::mutex> lock(render_mutex);
+
+			while (true)
+			{
+				render_condition.wait(lock, [] { return render_thread_stop || frames_drawn != frames_captured; });
+
+				if (frames_drawn == frames_captured)
 				{
-					cpu::set_request_interrupt_flag(cpu::INTERRUPT_LCD);
+					return; // stopping with every frame drawn
 				}
 
-				horz_cycle_count += 80;
-				break;
-			case MODE_VRAM_ACCESS:
-				memory_module::set_memory_access(memory_module::MEMORY_OAM, 0);
-				memory_module::set_memory_access(memory_module::MEMORY_VRAM, 0);
+				lock.unlock();
+				draw_frame(frame_jobs[frames_drawn % 2]);
+				frames_drawn++;
+				lock.lock();
+			}
+		}
 
-				horz_cycle_count += 172;
-				break;
+		// wait until count frames are drawn. frames are only outstanding with the render thread
+		void wait_frames_drawn(u32 count)
+		{
+			while ((s32)(frames_drawn - count) < 0)
+			{
+				std::this_thread::yield();
+			}
+		}
+
+		void enable_render_thread()
+		{
+			if (render_thread_enabled)
+			{
+				return;
+			}
+
+			render_thread_stop = false;
+			render_thread = std::thread(render_thread_func);
+			render_thread_enabled = true;
+		}
+
+		void disable_render_thread()
+		{
+			if (!render_thread_enabled)
+			{
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(render_mutex);
+				render_thread_stop = true;
+			}
+
+			render_condition.notify_one();
+			render_thread.join();
+			render_thread_enabled = false;
+		}
+
+		// join the render thread when the process exits
+		struct render_thread_on_exit
+		{
+			~render_thread_on_exit()
+			{
+				disable_render_thread();
+			}
+		} render_thread_on_exit_instance;
+
+		void submit_frame()
+		{
+			frame_line_count = 0;
+
+			if (!render_thread_enabled)
+			{
+				draw_frame(frame_jobs[frames_captured % 2]);
+				frames_captured++;
+				frames_drawn++;
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(render_mutex);
+				frames_captured++;
 			}
 
+			render_condition.notify_one();
+		}
+
+		void capture_line(u8 line)
+		{
+			frame_job& job = frame_jobs[frames_captured % 2];
+
+			// the frame starts from the vram and oam the lcd sees now. also when the lcd starts over without finishing
+			// the frame
+			if (line == 0)
+			{
+				wait_frames_drawn(frames_captured - 1); // the job was last drawn two frames back
+				memcpy(job.vram, mbc::memory_vram, sizeof(job.vram));
+				memcpy(job.oam, mbc::memory_oam, sizeof(job.oam));
+				job.writes.clear();
+			}
+
+			line_registers& regs = job.lines[line];
+			regs.lcd_control = *lcd_control;
+			regs.scrollX = *scrollX;
+			regs.scrollY = *scrollY;
+			regs.windowX = *windowX;
+			regs.windowY = *windowY;
+			regs.sprites_hidden = oam_scan_dma_active;
+			memcpy(regs.shades, palette_shades, sizeof(regs.shades));
+
+			frame_line_count = line + 1;
+
+			if (line == height - 1)
+			{
+				submit_frame();
+			}
+		}
+
+		void lcd_memory_written(u16 addr, u8 value)
+		{
+			if (frame_line_count > 0)
+			{
+				frame_jobs[frames_captured % 2].writes.push_back({ addr, frame_line_count, value });
+			}
+		}
+
+		int increment_scanline(lcd_position& pos)
+		{
+			pos.line++;
+			pos.steps |= STEP_LINE_INC;
+
 			return 0;
 		}
 
-		int update_lcd_scanline_lcd_enabling()
+		int switch_lcd_mode(lcd_position& pos, u8 lcd_mode)
 		{
-			u8 lcd_mode = get_lcd_status_mode();
-			bool req_lcd_interrupt = false;
+			pos.mode = lcd_mode;
+			pos.scanline_inc = false;
+			pos.steps |= STEP_MODE;
 
 			switch (lcd_mode)
 			{
 			case MODE_HBLANK:
-				if (horz_cycle_count < 0)
-				{
-					memory_module::set_memory_access(memory_module::MEMORY_OAM, 0);
-					memory_module::set_memory_access(memory_module::MEMORY_VRAM, 0);
+				pos.oam_access = 0x3;
+				pos.vram_access = 0x3;
+				pos.horz_cycle_count += 204;
+				break;
+			case MODE_VBLANK:
+				pos.oam_access = 0x3;
+				pos.vram_access = 0x3;
+				pos.horz_cycle_count += 456;
+				break;
+			case MODE_OAM_ACCESS:
+				pos.oam_access = 0;
+				pos.horz_cycle_count += 80;
+				break;
+			case MODE_VRAM_ACCESS:
+				pos.oam_access = 0;
+				pos.vram_access = 0;
+				pos.horz_cycle_count += 172;
+				break;
+			}
+
+			return 0;
+		}
 
-					set_lcd_status_mode(MODE_VRAM_ACCESS);
-					horz_cycle_count += 172;
+		int update_lcd_scanline_lcd_enabling(lcd_position& pos)
+		{
+			switch (pos.mode)
+			{
+			case MODE_HBLANK:
+				if (pos.horz_cycle_count < 0)
+				{
+					pos.oam_access = 0;
+					pos.vram_access = 0;
+					pos.mode = MODE_VRAM_ACCESS;
+					pos.steps |= STEP_MODE;
+					pos.horz_cycle_count += 172;
 				}
 				break;
 			case MODE_VRAM_ACCESS:
-				if (horz_cycle_count < 0)
+				if (pos.horz_cycle_count < 0)
 				{
-					lcd_enabling = false;
-					switch_lcd_mode(MODE_HBLANK);
+					pos.lcd_enabling = false;
+					switch_lcd_mode(pos, MODE_HBLANK);
 				}
 				break;
 			case MODE_VBLANK:
@@ -498,64 +874,61 @@ namespace gameboy
 			return 0;
 		}
 
-		int update_lcd_scanline()
+		int update_lcd_scanline(lcd_position& pos)
 		{
-			u8 lcd_mode = get_lcd_status_mode();
-			bool req_lcd_interrupt = false;
-
-			switch (lcd_mode)
+			switch (pos.mode)
 			{
 			case MODE_HBLANK:
-				if (!scanline_inc && horz_cycle_count <= 0)
+				if (!pos.scanline_inc && pos.horz_cycle_count <= 0)
 				{
 					// draw the scan line
-					increment_scanline();
-					scanline_inc = true;
-					memory_module::set_memory_access(memory_module::MEMORY_OAM, 0);
+					increment_scanline(pos);
+					pos.scanline_inc = true;
+					pos.oam_access = 0;
 				}
 
-				if (horz_cycle_count < 0)
+				if (pos.horz_cycle_count < 0)
 				{
-					switch_lcd_mode(MODE_OAM_ACCESS);
+					switch_lcd_mode(pos, MODE_OAM_ACCESS);
 				}
 				break;
 			case MODE_VBLANK:
-				if (horz_cycle_count < 0) // restart screen refresh
+				if (pos.horz_cycle_count < 0) // restart screen refresh
 				{
-					if (*scanline < 153)
+					if (pos.line < 153)
 					{
-						increment_scanline();
+						increment_scanline(pos);
 					}
 					else
 					{
-						*scanline = 0;
-						switch_lcd_mode(MODE_OAM_ACCESS);
+						pos.line = 0;
+						switch_lcd_mode(pos, MODE_OAM_ACCESS);
 					}
 
-					horz_cycle_count += 456;
+					pos.horz_cycle_count += 456;
 				}
 				break;
 			case MODE_OAM_ACCESS:
-				if (horz_cycle_count <= 0)
+				if (pos.horz_cycle_count <= 0)
 				{
-					memory_module::set_memory_access(memory_module::MEMORY_VRAM, 0);
+					pos.vram_access = 0;
 				}
 
-				if (horz_cycle_count < 0)
+				if (pos.horz_cycle_count < 0)
 				{
-					switch_lcd_mode(MODE_VRAM_ACCESS);
+					switch_lcd_mode(pos, MODE_VRAM_ACCESS);
 				}
 				break;
 			case MODE_VRAM_ACCESS:
-				if (horz_cycle_count < 0)
+				if (pos.horz_cycle_count < 0)
 				{
-					if (*scanline < 143)
+					if (pos.line < 143)
 					{
-						switch_lcd_mode(MODE_HBLANK);
+						switch_lcd_mode(pos, MODE_HBLANK);
 					}
 					else // enter vblank
 					{
-						switch_lcd_mode(MODE_VBLANK);
+						switch_lcd_mode(pos, MODE_VBLANK);
 					}
 				}
 				break;
@@ -563,76 +936,311 @@ namespace gameboy
 
 			return 0;
 		}
-		
-		int update(u8 cycles)
+
+		// the lcd steps when the horz cycle count reaches 0 (scanline increment) and again once it drops below 0 (mode switch)
+		inline u64 get_next_step_cycles(const lcd_position& pos)
+		{
+			return (pos.horz_cycle_count > 0 ? pos.horz_deadline : pos.horz_deadline + 1);
+		}
+
+		// run the step due at step_cycles on pos. returns the cycle of the next step
+		u64 run_lcd_step(lcd_position& pos, u64 step_cycles)
+		{
+			pos.steps = 0;
+			pos.horz_cycle_count = (s32)(pos.horz_deadline - step_cycles);
+
+			if (pos.lcd_enabling)
+			{
+				update_lcd_scanline_lcd_enabling(pos);
+			}
+			else
+			{
+				update_lcd_scanline(pos);
+			}
+
+			pos.horz_deadline = step_cycles + pos.horz_cycle_count;
+			return get_next_step_cycles(pos);
+		}
+
+		// the steps the lcd event stops on. read from the registers once for a search of the planned steps
+		struct lcd_event_sources
+		{
+			u8 modes; // bit per mode switched to
+			u16 coincidence_line; // line moved to. out of range with the coincidence interrupt off
+		};
+
+		lcd_event_sources get_lcd_event_sources()
+		{
+			// the end of the frame and the vblank interrupt always
+			lcd_event_sources sources;
+			sources.modes = (1 << MODE_VBLANK);
+			sources.coincidence_line = 0x100;
+
+			// with the lcd interrupt disabled the stat sources only set the request flag. that is caught up when the
+			// interrupt registers are accessed
+			if (cpu::get_enabled_interrupt_flag(cpu::INTERRUPT_LCD))
+			{
+				sources.modes |= (get_lcd_interrupt_flag(FLAG_HBLANK) ? (1 << MODE_HBLANK) : 0);
+				sources.modes |= (get_lcd_interrupt_flag(FLAG_OAM_ACCESS) ? (1 << MODE_OAM_ACCESS) : 0);
+				sources.coincidence_line = (get_lcd_interrupt_flag(FLAG_COINCIDENCE) ? *coincidence_scanline : 0x100);
+			}
+
+			return sources;
+		}
+
+		// true if the steps pos just ran finish the frame or raise an interrupt the cpu takes
+		inline bool is_lcd_event_step(const lcd_position& pos, const lcd_event_sources& sources)
+		{
+			return ((pos.steps & STEP_LINE_INC) && (pos.line == height || pos.line == sources.coincidence_line)) ||
+				((pos.steps & STEP_MODE) && (sources.modes & (1 << pos.mode)));
+		}
+
+		void check_coincidence_flag()
+		{
+			if (*coincidence_scanline != *scanline)
+			{
+				*lcd_status &= ~(1 << 2); // clear bit 2 for coincidence
+			}
+
+			if (lcd.scanline_inc)
+			{
+				return;
+			}
+
+			// check for coincidence flag
+			if (*coincidence_scanline == *scanline)
+			{
+				*lcd_status |= (1 << 2); // set bit 2 for coincidence
+			}
+		}
+
+		// run the lcd step due now and make what it did visible. ly, stat, memory access, line capture and interrupts
+		void update_lcd(u64 now)
 		{
 			if (get_lcd_control_flag(FLAG_LCD_DISPLAY_ENABLED) == false)
 			{
 				if (lcd_enabled)
 				{
-					u8* framebuffer_ptr = (u8*)framebuffer;
-					u32 color = gpu::get_palette_color(0, 0);
-
-					for (u32 i = 0; i < (width * height); i++)
-					{
-						*framebuffer_ptr++ = (color >> 24) & 0xFF;
-						*framebuffer_ptr++ = (color >> 16) & 0xFF;
-						*framebuffer_ptr++ = (color >> 8) & 0xFF;
-						*framebuffer_ptr++ = 0xFF;
-					}
+					// a disabled lcd shows white. the lines captured so far are never drawn
+					wait_frames_drawn(frames_captured);
+					clear_framebuffers();
+					frame_line_count = 0;
 				}
 
 				lcd_enabled = false;
 				set_lcd_status_mode(MODE_HBLANK);
 				*scanline = 0;
+				check_coincidence_flag();
 
-				return 0;
+				// nothing to do until the lcd is enabled again. the lcd control write runs the next step
+				drop_lcd_plan();
+				lcd_step_cycles = scheduler::event_none;
+				scheduler::set_lazy_cycles(scheduler::LAZY_LCD, lcd_step_cycles);
+				return;
 			}
 
 			if (!lcd_enabled)
 			{
 				// lcd being re enabled. reset scanline and horz cycle count. lcd mode set to hblank
 				lcd_enabled = true;
-				lcd_enabling = true;
+				lcd.lcd_enabling = true;
+				lcd.horz_deadline = now + 68;
 				*scanline = 0;
-				horz_cycle_count = 68;
+				oam_scan_dma_active = memory_module::dma_active;
+				drop_lcd_plan();
 
 				set_lcd_status_mode(MODE_HBLANK);
 			}
-			else
+
+			// ly and the mode bits are the registers. a write to stat or ly is seen by the next step
+			u8 line = *scanline;
+			u8 mode = get_lcd_status_mode();
+			if (line != lcd.line || mode != lcd.mode)
 			{
-				horz_cycle_count -= cycles;
+				drop_lcd_plan();
 			}
 
-			if (lcd_enabling)
+			lcd.mode = mode;
+			lcd.line = line;
+			lcd.oam_access = memory_module::memory_map[memory_module::MEMORY_OAM].access;
+			lcd.vram_access = memory_module::memory_map[memory_module::MEMORY_VRAM].access;
+
+			if (lcd_plan_next < lcd_plan_count && now == lcd_step_cycles)
 			{
-				update_lcd_scanline_lcd_enabling();
+				// the step was run when the event was planned
+				lcd = lcd_plan[lcd_plan_next++];
+				lcd_step_cycles = get_next_step_cycles(lcd);
 			}
 			else
 			{
-				update_lcd_scanline();
+				// a step run late moves the ones after it. a register write between steps leaves the position alone
+				if (now >= lcd_step_cycles)
+				{
+					drop_lcd_plan();
+				}
+
+				lcd_step_cycles = run_lcd_step(lcd, now);
 			}
 
-			return 0;
+			scheduler::set_lazy_cycles(scheduler::LAZY_LCD, lcd_step_cycles);
+
+			*scanline = lcd.line;
+			memory_module::set_memory_access(memory_module::MEMORY_OAM, lcd.oam_access);
+			memory_module::set_memory_access(memory_module::MEMORY_VRAM, lcd.vram_access);
+
+			if (lcd.steps & STEP_LINE_INC)
+			{
+				if (line < height)
+				{
+					capture_line(line);
+				}
+
+				if (*coincidence_scanline == lcd.line && get_lcd_interrupt_flag(FLAG_COINCIDENCE))
+				{
+					cpu::set_request_interrupt_flag(cpu::INTERRUPT_LCD);
+				}
+			}
+
+			if (lcd.steps & STEP_MODE)
+			{
+				set_lcd_status_mode(lcd.mode);
+
+				switch (lcd.mode)
+				{
+				case MODE_HBLANK:
+					if (get_lcd_interrupt_flag(FLAG_HBLANK))
+					{
+						cpu::set_request_interrupt_flag(cpu::INTERRUPT_LCD);
+					}
+					break;
+				case MODE_VBLANK:
+					cpu::set_request_interrupt_flag(cpu::INTERRUPT_VBLANK);
+
+					if (get_lcd_interrupt_flag(FLAG_VBLANK))
+					{
+						cpu::set_request_interrupt_flag(cpu::INTERRUPT_LCD);
+					}
+
+					vblank_occurred = true;
+					break;
+				case MODE_OAM_ACCESS:
+					// the line picks its sprites now. a dma started later in the line does not hide them
+					oam_scan_dma_active = memory_module::dma_active;
+
+					if (get_lcd_interrupt_flag(FLAG_OAM_ACCESS))
+					{
+						cpu::set_request_interrupt_flag(cpu::INTERRUPT_LCD);
+					}
+					break;
+				}
+			}
+
+			check_coincidence_flag();
 		}
 
-		void check_coincidence_flag()
+		// run the steps due up to until_cycles, each on the cycle it was due
+		void catch_up(u64 until_cycles)
 		{
-			if (*coincidence_scanline != *scanline)
+			while (lcd_step_cycles <= until_cycles)
 			{
-				*lcd_status &= ~(1 << 2); // clear bit 2 for coincidence
+				update_lcd(lcd_step_cycles);
 			}
+		}
 
-			if (scanline_inc)
+		// the event only runs on the steps that raise an interrupt or finish the frame. the steps already planned are
+		// searched for the next one first, since the registers picking it may have changed. otherwise a copy of the lcd
+		// is run further ahead. with the stat interrupts off the event is the vblank, plus a wake up every max_planned_steps
+		void schedule_lcd_event()
+		{
+			if (!lcd_enabled)
 			{
+				drop_lcd_plan();
 				return;
 			}
 
-			// check for coincidence flag
-			if (*coincidence_scanline == *scanline)
+			lcd_event_sources sources = get_lcd_event_sources();
+			u64 step_cycles = lcd_step_cycles;
+			for (u32 i = lcd_plan_next; i < lcd_plan_count; i++)
 			{
-				*lcd_status |= (1 << 2); // set bit 2 for coincidence
+				if (is_lcd_event_step(lcd_plan[i], sources))
+				{
+					scheduler::schedule_event(scheduler::EVENT_LCD, step_cycles);
+					return;
+				}
+
+				step_cycles = get_next_step_cycles(lcd_plan[i]);
+			}
+
+			// move the steps still to come to the front and plan on from the last one
+			lcd_position pos = lcd;
+			pos.mode = get_lcd_status_mode();
+			pos.line = *scanline;
+
+			if (lcd_plan_next < lcd_plan_count)
+			{
+				pos = lcd_plan[lcd_plan_count - 1];
 			}
+
+			lcd_plan_count -= lcd_plan_next;
+			memmove(lcd_plan, &lcd_plan[lcd_plan_next], lcd_plan_count * sizeof(lcd_position));
+			lcd_plan_next = 0;
+
+			while (lcd_plan_count < max_planned_steps)
+			{
+				u64 next_step_cycles = run_lcd_step(pos, step_cycles);
+				lcd_plan[lcd_plan_count++] = pos;
+
+				if (is_lcd_event_step(pos, sources))
+				{
+					break;
+				}
+
+				step_cycles = next_step_cycles;
+			}
+
+			scheduler::schedule_event(scheduler::EVENT_LCD, step_cycles);
+		}
+
+		void update_lcd_event(u64 event_cycles)
+		{
+			catch_up(event_cycles);
+
+			if (lcd_registers_written)
+			{
+				// lcd control, stat, ly and lyc take effect once the instruction writing them is done
+				lcd_registers_written = false;
+				update_lcd(scheduler::cycles);
+			}
+
+			schedule_lcd_event();
+		}
+
+		void lcd_register_written()
+		{
+			// lcd control, stat, ly and lyc take effect on the next cycle
+			lcd_registers_written = true;
+			scheduler::schedule_event(scheduler::EVENT_LCD, scheduler::cycles + 1);
+		}
+
+		void interrupt_enable_written()
+		{
+			// the lcd interrupt bit decides which steps the event stops on. a pending register write plans again anyway
+			if (!lcd_registers_written)
+			{
+				schedule_lcd_event();
+			}
+		}
+
+		s32 get_horz_cycle_count()
+		{
+			catch_up(scheduler::cycles);
+
+			if (!lcd_enabled)
+			{
+				return lcd.horz_cycle_count;
+			}
+
+			return (s32)(lcd.horz_deadline - scheduler::cycles);
 		}
 	}
 }
\ No newline at end of file
@@ -0,0 +1,264 @@
+#pragma once
+
+#include "defines.h"
+
+#include "cpu.h"
+#include "scheduler.h"
+
+// busy wait loops like "LDH A,(44) / CP n / JR NZ" only poll memory until the lcd or timer changes it.
+// when a loop iteration does not write memory and ends with the same registers it started with, every
+// following iteration is identical until the next scheduled event or a change to the lazy state it reads, like
+// ly or the divider. those iterations are skipped
+
+namespace gameboy
+{
+	namespace idle_loop
+	{
+		const u16 max_loop_size = 32; // bytes from the loop start to the backward branch
+
+		struct loop_info
+		{
+			u16 addr_start;
+			u16 addr_branch;
+			u64 skipped_cycles;
+		};
+
+		std::vector<loop_info> detected_loops; // shown in the debugger
+		s32 last_detected_loop = -1;
+
+		// loop currently being checked
+		u16 candidate_start = 0;
+		u16 candidate_branch = 0;
+		bool candidate_valid = false;
+		bool candidate_snapshot = false;
+
+		// state at the start of the last iteration
+		cpu::registers snapshot_registers;
+		bool snapshot_interrupt_master = false;
+		u64 snapshot_cycles = 0;
+		u64 snapshot_next_event_cycles = 0;
+		u64 snapshot_lazy_cycles[scheduler::LAZY_COUNT];
+		u32 snapshot_cycle_count = 0;
+
+		// length of an instruction that can not write memory or change control flow other than by a relative
+		// or absolute jump. 0 if the instruction is not allowed in an idle loop
+		u8 get_idle_instruction_length(u16 addr)
+		{
+			u8 opcode = memory_module::read_memory(addr, true);
+
+			if (opcode >= 0x40 && opcode <= 0x7F) // LD r, r. no stores to (HL) or HALT
+			{
+				return (opcode >= 0x70 && opcode <= 0x77) ? 0 : 1;
+			}
+
+			if (opcode >= 0x80 && opcode <= 0xBF) // ALU A, r
+			{
+				return 1;
+			}
+
+			switch (opcode)
+			{
+			case 0x00: // NOP
+			case 0x03: case 0x13: case 0x23: case 0x33: // INC rr
+			case 0x0B: case 0x1B: case 0x2B: case 0x3B: // DEC rr
+			case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C: // INC r
+			case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D: // DEC r
+			case 0x07: case 0x0F: case 0x17: case 0x1F: // RLCA, RRCA, RLA, RRA
+			case 0x27: case 0x2F: case 0x37: case 0x3F: // DAA, CPL, SCF, CCF
+			case 0x09: case 0x19: case 0x29: case 0x39: // ADD HL, rr
+			case 0x0A: case 0x1A: case 0x2A: case 0x3A: // LD A, (rr)
+			case 0xF2: // LD A, (C)
+				return 1;
+			case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E: // LD r, n
+			case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE: // ALU A, n
+			case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // JR
+			case 0xF0: // LDH A, (n)
+				return 2;
+			case 0x01: case 0x11: case 0x21: case 0x31: // LD rr, nn
+			case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: // JP
+			case 0xFA: // LD A, (nn)
+				return 3;
+			case 0xCB:
+			{
+				// BIT on anything. rotates, res and set only on registers
+				u8 cb_opcode = memory_module::read_memory(addr + 1, true);
+				return ((cb_opcode & 0x7) != 0x6 || (cb_opcode >> 6) == 0x1) ? 2 : 0;
+			}
+			}
+
+			return 0;
+		}
+
+		bool is_idle_loop_body(u16 addr_start, u16 addr_branch)
+		{
+			if (addr_branch - addr_start >= max_loop_size)
+			{
+				return false;
+			}
+
+			u16 addr = addr_start;
+			while (addr < addr_branch)
+			{
+				u8 length = get_idle_instruction_length(addr);
+				if (length == 0)
+				{
+					return false;
+				}
+
+				addr += length;
+			}
+
+			// the backward branch has to be an instruction boundary and a jump itself
+			u8 opcode = memory_module::read_memory(addr_branch, true);
+			bool is_jump = (opcode == 0x18 || opcode == 0x20 || opcode == 0x28 || opcode == 0x30 || opcode == 0x38 ||
+				opcode == 0xC2 || opcode == 0xC3 || opcode == 0xCA || opcode == 0xD2 || opcode == 0xDA);
+
+			return addr == addr_branch && is_jump;
+		}
+
+		void add_detected_loop(u16 addr_start, u16 addr_branch, u32 skipped_cycles)
+		{
+			for (u32 i = 0; i < detected_loops.size(); i++)
+			{
+				if (detected_loops[i].addr_start == addr_start && detected_loops[i].addr_branch == addr_branch)
+				{
+					detected_loops[i].skipped_cycles += skipped_cycles;
+					last_detected_loop = i;
+					return;
+				}
+			}
+
+			detected_loops.push_back({ addr_start, addr_branch, skipped_cycles });
+			last_detected_loop = (s32)detected_loops.size() - 1;
+		}
+
+		bool is_in_detected_loop(u16 addr)
+		{
+			for (auto itr = detected_loops.begin(); itr != detected_loops.end(); itr++)
+			{
+				if (addr >= itr->addr_start && addr <= itr->addr_branch)
+				{
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		void take_snapshot(u32 cycle_count)
+		{
+			snapshot_registers = cpu::R;
+			snapshot_interrupt_master = cpu::interrupt_master;
+			snapshot_cycles = scheduler::cycles;
+			snapshot_next_event_cycles = scheduler::next_event_cycles;
+			memcpy(snapshot_lazy_cycles, scheduler::lazy_cycles, sizeof(snapshot_lazy_cycles));
+			snapshot_cycle_count = cycle_count;
+			candidate_snapshot = true;
+
+			// the iteration from here tells which lazy state the loop reads
+			scheduler::lazy_reads = 0;
+		}
+
+		// the first cycle after the snapshot an event ran or the lazy state in lazy_mask changed
+		u64 get_snapshot_next_change_cycles(u8 lazy_mask)
+		{
+			u64 next_cycles = snapshot_next_event_cycles;
+
+			for (u8 i = 0; i < scheduler::LAZY_COUNT; i++)
+			{
+				if ((lazy_mask & (1 << i)) && snapshot_lazy_cycles[i] < next_cycles)
+				{
+					next_cycles = snapshot_lazy_cycles[i];
+				}
+			}
+
+			return next_cycles;
+		}
+
+		// called after a jump to an address at or before the jump. cycle_count is the frame cycle count and
+		// max_cycle_count the end of the frame. returns the frame cycles skipped
+		u32 on_backward_branch(u16 addr_branch, u32 cycle_count, u32 max_cycle_count)
+		{
+			u16 addr_start = cpu::R.pc;
+
+			if (addr_start != candidate_start || addr_branch != candidate_branch)
+			{
+				// new loop. check the body only once
+				candidate_start = addr_start;
+				candidate_branch = addr_branch;
+				candidate_valid = is_idle_loop_body(addr_start, addr_branch);
+				candidate_snapshot = false;
+			}
+
+			if (!candidate_valid || cpu::paused || cpu::eiOcccurred || cpu::debug_hooks_armed)
+			{
+				return 0;
+			}
+
+			// the loop may be polling lazy state like ly. bring it up to date so the skip stops in front of its next change
+			scheduler::catch_up_lazy();
+
+			// an interrupt the catch up requested is taken before the next iteration. its handler would become part of
+			// the iteration and its writes would be skipped with it
+			if (cpu::interrupt_master && (*cpu::interrupt_request_flag & *cpu::interrupt_enable_flag & 0x1F))
+			{
+				candidate_snapshot = false;
+				return 0;
+			}
+
+			// the last iteration has to be complete within this frame with no event run during it and no change to the
+			// lazy state it read
+			u8 lazy_reads = scheduler::lazy_reads;
+			if (!candidate_snapshot || cycle_count <= snapshot_cycle_count || cycle_count >= max_cycle_count || scheduler::cycles <= snapshot_cycles ||
+				snapshot_interrupt_master != cpu::interrupt_master || memcmp(&snapshot_registers, &cpu::R, sizeof(cpu::R)) != 0 ||
+				scheduler::cycles >= get_snapshot_next_change_cycles(lazy_reads))
+			{
+				take_snapshot(cycle_count);
+				return 0;
+			}
+
+			// fixed point. skip the iterations that end before the next event and before the end of the frame
+			u32 iteration_cycles = (u32)(scheduler::cycles - snapshot_cycles);
+			u32 iteration_cycle_count = cycle_count - snapshot_cycle_count;
+
+			u64 iterations = (scheduler::get_next_change_cycles(lazy_reads) - scheduler::cycles - 1) / iteration_cycles;
+			u64 frame_iterations = (max_cycle_count - cycle_count - 1) / iteration_cycle_count;
+
+			if (frame_iterations < iterations)
+			{
+				iterations = frame_iterations;
+			}
+
+			if (iterations == 0)
+			{
+				take_snapshot(cycle_count);
+				return 0;
+			}
+
+			scheduler::add_cycles((u32)iterations * iteration_cycles);
+
+			u32 skipped_cycle_count = (u32)iterations * iteration_cycle_count;
+			add_detected_loop(addr_start, addr_branch, skipped_cycle_count);
+
+			take_snapshot(cycle_count + skipped_cycle_count);
+
+			return skipped_cycle_count;
+		}
+
+		void new_frame()
+		{
+			// input may have changed between frames. start the fixed point check again
+			candidate_snapshot = false;
+		}
+
+		void reset()
+		{
+			detected_loops.clear();
+			last_detected_loop = -1;
+			candidate_start = 0;
+			candidate_branch = 0;
+			candidate_valid = false;
+			candidate_snapshot = false;
+		}
+	}
+}
\ No newline at end of file
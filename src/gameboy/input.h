@@ -69,6 +69,13 @@ namespace gameboy
 		}
 	}
 
+	// joypad register as read by the cpu. bit 5 low selects the buttons, otherwise the directional keys
+	inline u8 get_joypad_register(u8 joypad_select)
+	{
+		u8 keys = ((joypad_select & 0x20) == 0 ? input_buttons : input_directional);
+		return (joypad_select & 0xF0) | (keys & 0xF); // only lower 4 bits
+	}
+
 	enum BUTTONS
 	{
 		BUTTON_A,
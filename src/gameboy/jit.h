@@ -0,0 +1,796 @@
+#pragma once
+
+#include "defines.h"
+
+#include "block_cache.h"
+
+// hot cached blocks are translated to x86-64 code. the register ops (LD r, r and r, n, LD rr, nn, INC and DEC r and
+// rr, ALU A with r or n, JR and JP) are emitted as native code working on the cpu registers in memory. a run of them
+// checks the frame budget and the next scheduler event once up front, then adds its cycles in one go. every other op
+// is a call of its opcode handler with the block executor checks in front of it. when a run would reach an event or
+// the end of the frame the rest of the block goes back to the interpreter. blocks in ram (self modifying code) and
+// blocks touching the io registers are never translated. the code buffer is writable only while a block is emitted
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define JIT_X64
+#endif
+
+#ifdef JIT_X64
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#endif
+
+namespace gameboy
+{
+	namespace jit
+	{
+		const u32 code_buffer_size = 16 * 1024 * 1024;
+		const u32 max_op_code_size = 384; // upper bound of the code emitted for one op, its exit stubs included
+		const u32 compile_threshold = 16; // block runs before it is translated
+
+		// runs the ops of a block from first_op on in the interpreter. the checks in front of first_op are done
+		typedef int(*block_ops_function)(const block_cache::block* cached_block, u8 first_op, int cycles, s32 max_cycles, u16* opcode_pc, s32 stop_pc);
+
+		// cpu state the translated code reads. filled in by the cpu
+		struct context
+		{
+			u8* registers; // the native ops address the registers relative to this
+			u8* reg8[8]; // register_single order. (HL) is null
+			u16* reg16[4]; // register_pairs order
+			u8* f;
+			u16* pc;
+			u32* page_table_generation;
+			bool* ei_occurred;
+			u8** interrupt_enable_flag;
+			u8** interrupt_request_flag;
+			u64* cycles;
+			u64* next_event_cycles;
+			void(*materialize_flags)(); // null unless the handlers leave the flags pending
+			block_ops_function run_block_ops;
+		};
+
+		bool enabled = false;
+		context ctx;
+
+		u8* code_buffer = nullptr;
+		u32 code_size = 0;
+		u32 code_flush_count = 0; // block cache flush the code buffer was filled after
+		bool code_buffer_full = false;
+
+#ifdef JIT_X64
+		u8* emit_ptr = nullptr;
+
+		inline void emit_u8(u8 value)
+		{
+			*emit_ptr++ = value;
+		}
+
+		inline void emit_bytes(std::initializer_list<u8> values)
+		{
+			for (u8 value : values)
+			{
+				*emit_ptr++ = value;
+			}
+		}
+
+		inline void emit_u16(u16 value)
+		{
+			memcpy(emit_ptr, &value, sizeof(value));
+			emit_ptr += sizeof(value);
+		}
+
+		inline void emit_u32(u32 value)
+		{
+			memcpy(emit_ptr, &value, sizeof(value));
+			emit_ptr += sizeof(value);
+		}
+
+		inline void emit_u64(u64 value)
+		{
+			memcpy(emit_ptr, &value, sizeof(value));
+			emit_ptr += sizeof(value);
+		}
+
+		inline void emit_mov_rax(const void* ptr)
+		{
+			emit_bytes({ 0x48, 0xB8 }); // mov rax, imm64
+			emit_u64((u64)(uintptr_t)ptr);
+		}
+
+		inline void emit_call(const void* function)
+		{
+			emit_mov_rax(function);
+			emit_bytes({ 0xFF, 0xD0 }); // call rax
+		}
+
+		// rbp holds ctx.registers. the registers are a few bytes apart, so [rbp + disp8] reaches all of them
+		inline u8 get_register_offset(const void* reg)
+		{
+			return (u8)((const u8*)reg - ctx.registers);
+		}
+
+		// jumps to the code after the body are patched once it is emitted
+		enum LABEL_TYPE
+		{
+			LABEL_EXIT, // leave the block in front of an op, pc and opcode_pc set to the ops before it
+			LABEL_INTERPRET, // run the block from an op on in the interpreter
+		};
+
+		struct label_jump
+		{
+			u8* offset_ptr;
+			LABEL_TYPE type;
+			u8 op_idx;
+		};
+
+		std::vector<label_jump> label_jumps;
+
+		// jcc rel32 to a label
+		inline void emit_label_jump(u8 condition, LABEL_TYPE type, u8 op_idx)
+		{
+			emit_bytes({ 0x0F, condition });
+			label_jumps.push_back({ emit_ptr, type, op_idx });
+			emit_u32(0);
+		}
+
+		inline void patch_jump(u8* offset_ptr, u8* target)
+		{
+			s32 offset = (s32)(target - (offset_ptr + 4));
+			memcpy(offset_ptr, &offset, sizeof(offset));
+		}
+
+		const u8 jcc_ne = 0x85;
+		const u8 jcc_ge = 0x8D;
+		const u8 jcc_ae = 0x83;
+		const u8 jcc_be = 0x86;
+
+		// native op kinds. everything else calls its handler
+		enum NATIVE_OP
+		{
+			NATIVE_NONE,
+			NATIVE_NOP,
+			NATIVE_LD_R_R,
+			NATIVE_LD_R_N,
+			NATIVE_LD_RR_NN,
+			NATIVE_INC_RR,
+			NATIVE_DEC_RR,
+			NATIVE_INC_R,
+			NATIVE_DEC_R,
+			NATIVE_ALU_R,
+			NATIVE_ALU_N,
+			NATIVE_JR,
+			NATIVE_JR_CC,
+			NATIVE_JP,
+			NATIVE_JP_CC,
+		};
+
+		NATIVE_OP get_native_op(u8 opcode)
+		{
+			u8 x = (opcode >> 6);
+			u8 y = (opcode >> 3) & 0x7;
+			u8 z = (opcode & 0x7);
+
+			switch (x)
+			{
+			case 0x0:
+				switch (z)
+				{
+				case 0x0:
+					if (y == 0x0) return NATIVE_NOP;
+					if (y == 0x3) return NATIVE_JR;
+					if (y >= 0x4) return NATIVE_JR_CC;
+					return NATIVE_NONE;
+				case 0x1: return ((y & 0x1) == 0x0 ? NATIVE_LD_RR_NN : NATIVE_NONE);
+				case 0x3: return ((y & 0x1) == 0x0 ? NATIVE_INC_RR : NATIVE_DEC_RR);
+				case 0x4: return (y != 0x6 ? NATIVE_INC_R : NATIVE_NONE);
+				case 0x5: return (y != 0x6 ? NATIVE_DEC_R : NATIVE_NONE);
+				case 0x6: return (y != 0x6 ? NATIVE_LD_R_N : NATIVE_NONE);
+				}
+				return NATIVE_NONE;
+			case 0x1:
+				return (y != 0x6 && z != 0x6 ? NATIVE_LD_R_R : NATIVE_NONE);
+			case 0x2:
+				return (z != 0x6 ? NATIVE_ALU_R : NATIVE_NONE);
+			default:
+				if (opcode == 0xC3) return NATIVE_JP;
+				if (z == 0x2 && y < 0x4) return NATIVE_JP_CC;
+				if (z == 0x6) return NATIVE_ALU_N;
+				return NATIVE_NONE;
+			}
+		}
+
+		// cycles of a native op, the taken branch for JR and JP cc
+		u32 get_native_op_cycles(NATIVE_OP native_op)
+		{
+			switch (native_op)
+			{
+			case NATIVE_NOP: case NATIVE_LD_R_R: case NATIVE_INC_R: case NATIVE_DEC_R: case NATIVE_ALU_R: return 4;
+			case NATIVE_LD_R_N: case NATIVE_INC_RR: case NATIVE_DEC_RR: case NATIVE_ALU_N: return 8;
+			case NATIVE_LD_RR_NN: case NATIVE_JR: case NATIVE_JR_CC: return 12;
+			case NATIVE_JP: case NATIVE_JP_CC: return 16;
+			default: return 0;
+			}
+		}
+
+		// F from the result in eax, a ^ operand in edx and N. same as cpu::compute_flags
+		void emit_result_flags(u8 subtraction)
+		{
+			u8 f = get_register_offset(ctx.f);
+			emit_bytes({ 0x31, 0xC2 }); // xor edx, eax
+			emit_bytes({ 0x83, 0xE2, 0x10 }); // and edx, 0x10
+			emit_bytes({ 0x01, 0xD2 }); // add edx, edx. half carry to bit 5
+			emit_bytes({ 0x89, 0xC1 }); // mov ecx, eax
+			emit_bytes({ 0xC1, 0xE9, 0x04 }); // shr ecx, 4
+			emit_bytes({ 0x83, 0xE1, 0x10 }); // and ecx, 0x10. carry from bit 8 to bit 4
+			emit_bytes({ 0x09, 0xCA }); // or edx, ecx
+			emit_bytes({ 0x84, 0xC0 }); // test al, al
+			emit_bytes({ 0x75, 0x03 }); // jnz +3
+			emit_bytes({ 0x80, 0xCA, 0x80 }); // or dl, 0x80
+			if (subtraction)
+			{
+				emit_bytes({ 0x80, 0xCA, subtraction }); // or dl, subtraction
+			}
+			emit_bytes({ 0x88, 0x55, f }); // mov [rbp + f], dl
+		}
+
+		// A = A op operand. the operand is loaded to ecx
+		void emit_alu(u8 idx)
+		{
+			u8 a = get_register_offset(ctx.reg8[0x7]);
+			u8 f = get_register_offset(ctx.f);
+
+			emit_bytes({ 0x0F, 0xB6, 0x45, a }); // movzx eax, byte [rbp + a]
+
+			if (idx == 0x1 || idx == 0x3) // ADC, SBC. carry to r8d
+			{
+				emit_bytes({ 0x44, 0x0F, 0xB6, 0x45, f }); // movzx r8d, byte [rbp + f]
+				emit_bytes({ 0x41, 0xC1, 0xE8, 0x04 }); // shr r8d, 4
+				emit_bytes({ 0x41, 0x83, 0xE0, 0x01 }); // and r8d, 1
+			}
+
+			switch (idx)
+			{
+			case 0x0: // ADD
+			case 0x1: // ADC
+				emit_bytes({ 0x89, 0xC2 }); // mov edx, eax
+				emit_bytes({ 0x31, 0xCA }); // xor edx, ecx
+				emit_bytes({ 0x01, 0xC8 }); // add eax, ecx
+				if (idx == 0x1)
+				{
+					emit_bytes({ 0x44, 0x01, 0xC0 }); // add eax, r8d
+				}
+				emit_result_flags(0x0);
+				break;
+			case 0x2: // SUB
+			case 0x3: // SBC
+			case 0x7: // CP
+				emit_bytes({ 0x89, 0xC2 }); // mov edx, eax
+				emit_bytes({ 0x31, 0xCA }); // xor edx, ecx
+				emit_bytes({ 0x29, 0xC8 }); // sub eax, ecx. a borrow sets bit 8
+				if (idx == 0x3)
+				{
+					emit_bytes({ 0x44, 0x29, 0xC0 }); // sub eax, r8d
+				}
+				emit_result_flags(0x40);
+				break;
+			default: // AND, XOR, OR
+				if (idx == 0x4)
+				{
+					emit_bytes({ 0x21, 0xC8 }); // and eax, ecx
+				}
+				else if (idx == 0x5)
+				{
+					emit_bytes({ 0x31, 0xC8 }); // xor eax, ecx
+				}
+				else
+				{
+					emit_bytes({ 0x09, 0xC8 }); // or eax, ecx
+				}
+				emit_bytes({ 0xB2, (u8)(idx == 0x4 ? 0x20 : 0x0) }); // mov dl, half carry
+				emit_bytes({ 0x84, 0xC0 }); // test al, al
+				emit_bytes({ 0x75, 0x03 }); // jnz +3
+				emit_bytes({ 0x80, 0xCA, 0x80 }); // or dl, 0x80
+				emit_bytes({ 0x88, 0x55, f }); // mov [rbp + f], dl
+				break;
+			}
+
+			if (idx != 0x7)
+			{
+				emit_bytes({ 0x88, 0x45, a }); // mov [rbp + a], al
+			}
+		}
+
+		// JR or JP cc. pc is the fall through unless the condition holds, which costs 4 more cycles
+		void emit_branch_condition(u8 condition, u16 target, u16 next_pc)
+		{
+			u8 f = get_register_offset(ctx.f);
+			u8 pc = get_register_offset(ctx.pc);
+
+			emit_bytes({ 0x66, 0xC7, 0x45, pc }); // mov word [rbp + pc], next pc
+			emit_u16(next_pc);
+			emit_bytes({ 0xF6, 0x45, f, (u8)(condition < 0x2 ? 0x80 : 0x10) }); // test byte [rbp + f], zero or carry
+			emit_bytes({ (u8)((condition & 0x1) ? 0x74 : 0x75), 0x17 }); // jz or jnz over the taken branch
+
+			u8* taken_start = emit_ptr;
+			emit_bytes({ 0x66, 0xC7, 0x45, pc }); // mov word [rbp + pc], target
+			emit_u16(target);
+			emit_bytes({ 0x83, 0xC3, 0x04 }); // add ebx, 4
+			emit_mov_rax(ctx.cycles);
+			emit_bytes({ 0x48, 0x83, 0x00, 0x04 }); // add qword [rax], 4
+			assert(emit_ptr - taken_start == 0x17);
+		}
+
+		// one native op at pc. flags have been materialized if the op reads or keeps some of them
+		void emit_native_op(NATIVE_OP native_op, u8 opcode, u16 pc)
+		{
+			u8 y = (opcode >> 3) & 0x7;
+			u8 z = (opcode & 0x7);
+			u8 n = memory_module::read_memory(pc + 1, true);
+			u16 nn = n | (memory_module::read_memory(pc + 2, true) << 8);
+
+			switch (native_op)
+			{
+			case NATIVE_NOP:
+				break;
+			case NATIVE_LD_R_R:
+				emit_bytes({ 0x0F, 0xB6, 0x45, get_register_offset(ctx.reg8[z]) }); // movzx eax, byte [rbp + r]
+				emit_bytes({ 0x88, 0x45, get_register_offset(ctx.reg8[y]) }); // mov [rbp + r], al
+				break;
+			case NATIVE_LD_R_N:
+				emit_bytes({ 0xC6, 0x45, get_register_offset(ctx.reg8[y]), n }); // mov byte [rbp + r], n
+				break;
+			case NATIVE_LD_RR_NN:
+				emit_bytes({ 0x66, 0xC7, 0x45, get_register_offset(ctx.reg16[y >> 1]) }); // mov word [rbp + rr], nn
+				emit_u16(nn);
+				break;
+			case NATIVE_INC_RR:
+				emit_bytes({ 0x66, 0xFF, 0x45, get_register_offset(ctx.reg16[y >> 1]) }); // inc word [rbp + rr]
+				break;
+			case NATIVE_DEC_RR:
+				emit_bytes({ 0x66, 0xFF, 0x4D, get_register_offset(ctx.reg16[y >> 1]) }); // dec word [rbp + rr]
+				break;
+			case NATIVE_INC_R:
+			case NATIVE_DEC_R:
+			{
+				// carry is kept. half carry from the low nibble
+				u8 r = get_register_offset(ctx.reg8[y]);
+				u8 f = get_register_offset(ctx.f);
+				emit_bytes({ 0x0F, 0xB6, 0x45, r }); // movzx eax, byte [rbp + r]
+				emit_bytes({ 0x0F, 0xB6, 0x4D, f }); // movzx ecx, byte [rbp + f]
+				emit_bytes({ 0x83, 0xE1, 0x10 }); // and ecx, 0x10
+
+				if (native_op == NATIVE_INC_R)
+				{
+					emit_bytes({ 0xFE, 0xC0 }); // inc al
+					emit_bytes({ 0x88, 0x45, r }); // mov [rbp + r], al
+					emit_bytes({ 0x75, 0x03 }); // jnz +3
+					emit_bytes({ 0x80, 0xC9, 0x80 }); // or cl, 0x80
+					emit_bytes({ 0xA8, 0x0F }); // test al, 0x0F
+				}
+				else
+				{
+					emit_bytes({ 0x80, 0xC9, 0x40 }); // or cl, 0x40
+					emit_bytes({ 0xFE, 0xC8 }); // dec al
+					emit_bytes({ 0x88, 0x45, r }); // mov [rbp + r], al
+					emit_bytes({ 0x75, 0x03 }); // jnz +3
+					emit_bytes({ 0x80, 0xC9, 0x80 }); // or cl, 0x80
+					emit_bytes({ 0x24, 0x0F }); // and al, 0x0F
+					emit_bytes({ 0x3C, 0x0F }); // cmp al, 0x0F
+				}
+
+				emit_bytes({ 0x75, 0x03 }); // jnz +3. inc wrapped the nibble to 0 or dec to F
+				emit_bytes({ 0x80, 0xC9, 0x20 }); // or cl, 0x20
+				emit_bytes({ 0x88, 0x4D, f }); // mov [rbp + f], cl
+				break;
+			}
+			case NATIVE_ALU_R:
+				emit_bytes({ 0x0F, 0xB6, 0x4D, get_register_offset(ctx.reg8[z]) }); // movzx ecx, byte [rbp + r]
+				emit_alu(y);
+				break;
+			case NATIVE_ALU_N:
+				emit_u8(0xB9); // mov ecx, n
+				emit_u32(n);
+				emit_alu(y);
+				break;
+			case NATIVE_JR:
+				emit_bytes({ 0x66, 0xC7, 0x45, get_register_offset(ctx.pc) }); // mov word [rbp + pc], target
+				emit_u16((u16)(pc + 2 + (s8)n));
+				break;
+			case NATIVE_JR_CC:
+				emit_branch_condition(y - 4, (u16)(pc + 2 + (s8)n), pc + 2);
+				break;
+			case NATIVE_JP:
+				emit_bytes({ 0x66, 0xC7, 0x45, get_register_offset(ctx.pc) }); // mov word [rbp + pc], nn
+				emit_u16(nn);
+				break;
+			case NATIVE_JP_CC:
+				emit_branch_condition(y, nn, pc + 3);
+				break;
+			default:
+				break;
+			}
+		}
+
+		// ops reading F or writing it. pending flags of a handler are materialized first, so they do not overwrite F later
+		inline bool native_op_uses_flags(NATIVE_OP native_op)
+		{
+			switch (native_op)
+			{
+			case NATIVE_INC_R: case NATIVE_DEC_R: case NATIVE_ALU_R: case NATIVE_ALU_N: case NATIVE_JR_CC: case NATIVE_JP_CC: return true;
+			default: return false;
+			}
+		}
+
+		// same early exits as the block executor in front of op_idx
+		void emit_block_checks(u8 op_idx, bool check_state)
+		{
+			if (check_state)
+			{
+				emit_mov_rax(ctx.page_table_generation);
+				emit_bytes({ 0x44, 0x39, 0x20 }); // cmp [rax], r12d
+				emit_label_jump(jcc_ne, LABEL_EXIT, op_idx);
+
+				emit_mov_rax(ctx.ei_occurred);
+				emit_bytes({ 0x80, 0x38, 0x00 }); // cmp byte [rax], 0
+				emit_label_jump(jcc_ne, LABEL_EXIT, op_idx);
+
+				emit_mov_rax(ctx.interrupt_enable_flag);
+				emit_bytes({ 0x48, 0x8B, 0x00 }); // mov rax, [rax]
+				emit_bytes({ 0x0F, 0xB6, 0x08 }); // movzx ecx, byte [rax]
+				emit_mov_rax(ctx.interrupt_request_flag);
+				emit_bytes({ 0x48, 0x8B, 0x00 }); // mov rax, [rax]
+				emit_bytes({ 0x22, 0x08 }); // and cl, [rax]
+				emit_bytes({ 0xF6, 0xC1, 0x1F }); // test cl, 0x1F
+				emit_label_jump(jcc_ne, LABEL_EXIT, op_idx);
+			}
+
+			emit_bytes({ 0x44, 0x39, 0xEB }); // cmp ebx, r13d
+			emit_label_jump(jcc_ge, LABEL_EXIT, op_idx);
+		}
+
+		// memory stats count the bytes the op fetches. native ops fetched their operands when they were translated
+		void emit_count_fetch(u16 addr, u8 length)
+		{
+#ifdef _WIN32
+			emit_u8(0xB9); // mov ecx, addr
+			emit_u32(addr);
+			emit_u8(0xBA); // mov edx, length
+			emit_u32(length);
+#else
+			emit_u8(0xBF); // mov edi, addr
+			emit_u32(addr);
+			emit_u8(0xBE); // mov esi, length
+			emit_u32(length);
+#endif
+			emit_call((const void*)memory_stats::count_fetch);
+		}
+
+		void emit_set_pc(u16 pc, u16 opcode_pc)
+		{
+			emit_bytes({ 0x66, 0xC7, 0x45, get_register_offset(ctx.pc) }); // mov word [rbp + pc], pc
+			emit_u16(pc);
+			emit_bytes({ 0x66, 0x41, 0xC7, 0x07 }); // mov word [r15], opcode pc
+			emit_u16(opcode_pc);
+		}
+#endif
+
+		// the code buffer is writable or executable, never both. only the pages of the block being emitted are flipped
+		void protect_code(u8* start, u32 size, bool writable)
+		{
+#ifdef JIT_X64
+#ifdef _WIN32
+			DWORD old_protect;
+			VirtualProtect(start, size, (writable ? PAGE_READWRITE : PAGE_EXECUTE_READ), &old_protect);
+
+			if (!writable)
+			{
+				FlushInstructionCache(GetCurrentProcess(), start, size);
+			}
+#else
+			uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+			uintptr_t page_start = (uintptr_t)start & ~(page_size - 1);
+			uintptr_t page_end = ((uintptr_t)start + size + page_size - 1) & ~(page_size - 1);
+			mprotect((void*)page_start, page_end - page_start, (writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC));
+#endif
+#endif
+		}
+
+		bool allocate_code_buffer()
+		{
+#ifdef JIT_X64
+			if (code_buffer == nullptr)
+			{
+#ifdef _WIN32
+				code_buffer = (u8*)VirtualAlloc(nullptr, code_buffer_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+				void* ptr = mmap(nullptr, code_buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				code_buffer = (ptr == MAP_FAILED ? nullptr : (u8*)ptr);
+#endif
+				if (code_buffer == nullptr)
+				{
+					printf("Error - could not allocate jit code buffer. running the interpreter\n");
+					enabled = false;
+					return false;
+				}
+			}
+
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		// translate a block to int fn(s32 max_cycles, u16* opcode_pc, s32 stop_pc), same contract as cpu::execute_block.
+		// null if the block can not be translated
+		block_cache::jit_function compile_block(const block_cache::block* cached_block)
+		{
+#ifdef JIT_X64
+			if (!enabled || !cached_block->jit_allowed || !allocate_code_buffer())
+			{
+				return nullptr;
+			}
+
+			// flushed blocks took their code with them
+			if (code_flush_count != block_cache::flush_count)
+			{
+				code_flush_count = block_cache::flush_count;
+				code_size = 0;
+				code_buffer_full = false;
+			}
+
+			u32 max_code_size = (cached_block->op_count + 1) * max_op_code_size;
+			if (code_size + max_code_size > code_buffer_size)
+			{
+				if (!code_buffer_full)
+				{
+					printf("Jit code buffer full. new blocks run in the interpreter\n");
+					code_buffer_full = true;
+				}
+
+				return nullptr;
+			}
+
+			u8* code_start = code_buffer + code_size;
+			protect_code(code_start, max_code_size, true);
+
+			emit_ptr = code_start;
+			label_jumps.clear();
+
+			// op pcs and native kinds. a run of native ops is checked as a whole
+			const u8 op_count = cached_block->op_count;
+			u16 op_pcs[block_cache::max_block_ops + 1];
+			u8 opcodes[block_cache::max_block_ops];
+			NATIVE_OP native_ops[block_cache::max_block_ops];
+
+			op_pcs[0] = cached_block->addr_start;
+			for (u8 i = 0; i < op_count; i++)
+			{
+				opcodes[i] = memory_module::read_memory(op_pcs[i], true);
+				native_ops[i] = (cached_block->ops[i].opcode_length == 1 ? get_native_op(opcodes[i]) : NATIVE_NONE);
+				op_pcs[i + 1] = op_pcs[i] + cached_block->ops[i].length;
+			}
+
+			// prologue. ebx counts cycles, rbp points to the registers, r12d holds the page table generation,
+			// r13d max cycles, r14d stop pc and r15 opcode pc
+			emit_bytes({ 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57 }); // push rbx, rbp, r12, r13, r14, r15
+			emit_bytes({ 0x48, 0x83, 0xEC, 0x38 }); // sub rsp, 56. shadow space, two stack arguments and 16 byte alignment
+#ifdef _WIN32
+			emit_bytes({ 0x41, 0x89, 0xCD }); // mov r13d, ecx
+			emit_bytes({ 0x49, 0x89, 0xD7 }); // mov r15, rdx
+			emit_bytes({ 0x45, 0x89, 0xC6 }); // mov r14d, r8d
+#else
+			emit_bytes({ 0x41, 0x89, 0xFD }); // mov r13d, edi
+			emit_bytes({ 0x49, 0x89, 0xF7 }); // mov r15, rsi
+			emit_bytes({ 0x41, 0x89, 0xD6 }); // mov r14d, edx
+#endif
+			emit_bytes({ 0x31, 0xDB }); // xor ebx, ebx
+			emit_bytes({ 0x48, 0xBD }); // mov rbp, registers
+			emit_u64((u64)(uintptr_t)ctx.registers);
+			emit_mov_rax(ctx.page_table_generation);
+			emit_bytes({ 0x44, 0x8B, 0x20 }); // mov r12d, [rax]
+
+			// like the block executor the cycles are only checked if the whole block does not fit
+			emit_bytes({ 0x41, 0x81, 0xFD }); // cmp r13d, block cycles
+			emit_u32(cached_block->cycles);
+			emit_bytes({ 0x7C, 0x06 }); // jl +6
+			emit_bytes({ 0x41, 0xBD }); // mov r13d, max int
+			emit_u32(0x7FFFFFFF);
+
+			// a stop pc inside the block is left to the interpreter
+			if (op_count > 1)
+			{
+				emit_bytes({ 0x44, 0x89, 0xF0 }); // mov eax, r14d
+				emit_u8(0x2D); // sub eax, pc of the second op
+				emit_u32(op_pcs[1]);
+				emit_u8(0x3D); // cmp eax, pc range
+				emit_u32(op_pcs[op_count - 1] - op_pcs[1]);
+				emit_label_jump(jcc_be, LABEL_INTERPRET, 0);
+			}
+
+			bool check_state = true; // an op since the last checks may have changed the interrupts or the pages
+			bool flags_pending = (ctx.materialize_flags != nullptr);
+
+			for (u8 i = 0; i < op_count;)
+			{
+				if (native_ops[i] == NATIVE_NONE)
+				{
+					if (i > 0)
+					{
+						emit_block_checks(i, check_state);
+					}
+
+					// handler runs with pc past the opcode bytes
+					const block_cache::block_op& op = cached_block->ops[i];
+					if (memory_stats::enabled)
+					{
+						emit_count_fetch(op_pcs[i], op.opcode_length);
+					}
+
+					emit_set_pc(op_pcs[i] + op.opcode_length, op_pcs[i]);
+					emit_call((const void*)op.handler);
+					emit_bytes({ 0x01, 0xC3 }); // add ebx, eax
+
+					check_state = true;
+					flags_pending = (ctx.materialize_flags != nullptr);
+					i++;
+					continue;
+				}
+
+				// run of native ops. nothing in it can raise an interrupt or remap a page. the state at the block entry is
+				// not checked, so an interrupt pending there stops the block after the first op. it is a run on its own
+				u8 run_start = i;
+				u8 run_end = i;
+				u32 run_cycles = 0;
+				u32 run_cycles_before_last = 0;
+				while (run_end < op_count && native_ops[run_end] != NATIVE_NONE && !(i == 0 && run_end == 1))
+				{
+					run_cycles_before_last = run_cycles;
+					run_cycles += get_native_op_cycles(native_ops[run_end]);
+					run_end++;
+				}
+
+				if (i > 0)
+				{
+					emit_block_checks(i, check_state);
+				}
+
+				// the interpreter would stop inside the run at the end of the frame
+				if (run_end - i > 1)
+				{
+					emit_bytes({ 0x8D, 0x83 }); // lea eax, [rbx + cycles to the last op]
+					emit_u32(run_cycles_before_last);
+					emit_bytes({ 0x44, 0x39, 0xE8 }); // cmp eax, r13d
+					emit_label_jump(jcc_ge, LABEL_INTERPRET, i);
+				}
+
+				// an event due inside the run is run by the interpreter on the op it is due after
+				emit_mov_rax(ctx.cycles);
+				emit_bytes({ 0x48, 0x8B, 0x08 }); // mov rcx, [rax]
+				emit_bytes({ 0x48, 0x81, 0xC1 }); // add rcx, run cycles
+				emit_u32(run_cycles);
+				emit_bytes({ 0x48, 0xBA }); // mov rdx, next event cycles
+				emit_u64((u64)(uintptr_t)ctx.next_event_cycles);
+				emit_bytes({ 0x48, 0x3B, 0x0A }); // cmp rcx, [rdx]
+				emit_label_jump(jcc_ae, LABEL_INTERPRET, i);
+
+				// a taken branch adds its extra cycles itself
+				NATIVE_OP last_op = native_ops[run_end - 1];
+				u32 fixed_cycles = run_cycles - ((last_op == NATIVE_JR_CC || last_op == NATIVE_JP_CC) ? 4 : 0);
+				emit_bytes({ 0x48, 0x81, 0x00 }); // add qword [rax], fixed cycles
+				emit_u32(fixed_cycles);
+				emit_bytes({ 0x81, 0xC3 }); // add ebx, fixed cycles
+				emit_u32(fixed_cycles);
+
+				for (; i < run_end; i++)
+				{
+					if (flags_pending && native_op_uses_flags(native_ops[i]))
+					{
+						emit_call((const void*)ctx.materialize_flags);
+						flags_pending = false;
+					}
+
+					if (memory_stats::enabled)
+					{
+						emit_count_fetch(op_pcs[i], cached_block->ops[i].length);
+					}
+
+					emit_native_op(native_ops[i], opcodes[i], op_pcs[i]);
+				}
+
+				check_state = (run_start == 0);
+
+				// pc at the end of the block. a branch has set it already and the next op sets it otherwise
+				if (last_op == NATIVE_JR || last_op == NATIVE_JR_CC || last_op == NATIVE_JP || last_op == NATIVE_JP_CC)
+				{
+					emit_bytes({ 0x66, 0x41, 0xC7, 0x07 }); // mov word [r15], opcode pc
+					emit_u16(op_pcs[run_end - 1]);
+				}
+				else if (run_end == op_count)
+				{
+					emit_set_pc(op_pcs[run_end], op_pcs[run_end - 1]);
+				}
+			}
+
+			// block exit. return the cycles run
+			u8* exit_ptr = emit_ptr;
+			emit_bytes({ 0x89, 0xD8 }); // mov eax, ebx
+			emit_bytes({ 0x48, 0x83, 0xC4, 0x38 }); // add rsp, 56
+			emit_bytes({ 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B }); // pop r15, r14, r13, r12, rbp, rbx
+			emit_u8(0xC3); // ret
+
+			// exits in front of an op and hand overs to the interpreter. one stub per op they are taken at
+			u8* label_stubs[2][block_cache::max_block_ops] = {};
+			for (const label_jump& jump : label_jumps)
+			{
+				u8*& stub = label_stubs[jump.type][jump.op_idx];
+				if (stub == nullptr)
+				{
+					stub = emit_ptr;
+
+					if (jump.type == LABEL_EXIT)
+					{
+						emit_set_pc(op_pcs[jump.op_idx], op_pcs[jump.op_idx - 1]);
+					}
+					else
+					{
+						emit_set_pc(op_pcs[jump.op_idx], op_pcs[jump.op_idx]);
+#ifdef _WIN32
+						emit_bytes({ 0x48, 0xB9 }); // mov rcx, block
+						emit_u64((u64)(uintptr_t)cached_block);
+						emit_u8(0xBA); // mov edx, op
+						emit_u32(jump.op_idx);
+						emit_bytes({ 0x41, 0x89, 0xD8 }); // mov r8d, ebx
+						emit_bytes({ 0x45, 0x89, 0xE9 }); // mov r9d, r13d
+						emit_bytes({ 0x4C, 0x89, 0x7C, 0x24, 0x20 }); // mov [rsp + 32], r15
+						emit_bytes({ 0x44, 0x89, 0x74, 0x24, 0x28 }); // mov [rsp + 40], r14d
+#else
+						emit_bytes({ 0x48, 0xBF }); // mov rdi, block
+						emit_u64((u64)(uintptr_t)cached_block);
+						emit_u8(0xBE); // mov esi, op
+						emit_u32(jump.op_idx);
+						emit_bytes({ 0x89, 0xDA }); // mov edx, ebx
+						emit_bytes({ 0x44, 0x89, 0xE9 }); // mov ecx, r13d
+						emit_bytes({ 0x4D, 0x89, 0xF8 }); // mov r8, r15
+						emit_bytes({ 0x45, 0x89, 0xF1 }); // mov r9d, r14d
+#endif
+						emit_call((const void*)ctx.run_block_ops);
+						emit_bytes({ 0x89, 0xC3 }); // mov ebx, eax
+					}
+
+					emit_u8(0xE9); // jmp exit
+					emit_u32(0);
+					patch_jump(emit_ptr - 4, exit_ptr);
+				}
+
+				patch_jump(jump.offset_ptr, stub);
+			}
+
+			u32 block_code_size = (u32)(emit_ptr - code_start);
+			assert(block_code_size <= max_code_size);
+			protect_code(code_start, max_code_size, false);
+
+			code_size += block_code_size;
+			code_size = (code_size + 15) & ~15u;
+
+			return (block_cache::jit_function)(void*)code_start;
+#else
+			return nullptr;
+#endif
+		}
+
+		void initialize(const context& cpu_context)
+		{
+			ctx = cpu_context;
+		}
+	}
+}
\ No newline at end of file
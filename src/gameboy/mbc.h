@@ -4,14 +4,28 @@
 
 namespace gameboy
 {
+	// cartridge type byte at 0x147 of the rom header
 	enum CATRIDGE_TYPE
 	{
-		ROM_ONLY = 0,
-		ROM_MBC1,
-		ROM_MBC1_RAM,
-		ROM_MBC1_RAM_BATTERY,
-		ROM_MBC2,
-		ROM_MBC2_BATTERY,
+		ROM_ONLY = 0x00,
+		ROM_MBC1 = 0x01,
+		ROM_MBC1_RAM = 0x02,
+		ROM_MBC1_RAM_BATTERY = 0x03,
+		ROM_MBC2 = 0x05,
+		ROM_MBC2_BATTERY = 0x06,
+		ROM_RAM = 0x08,
+		ROM_RAM_BATTERY = 0x09,
+		ROM_MBC3_TIMER_BATTERY = 0x0F,
+		ROM_MBC3_TIMER_RAM_BATTERY = 0x10,
+		ROM_MBC3 = 0x11,
+		ROM_MBC3_RAM = 0x12,
+		ROM_MBC3_RAM_BATTERY = 0x13,
+		ROM_MBC5 = 0x19,
+		ROM_MBC5_RAM = 0x1A,
+		ROM_MBC5_RAM_BATTERY = 0x1B,
+		ROM_MBC5_RUMBLE = 0x1C,
+		ROM_MBC5_RUMBLE_RAM = 0x1D,
+		ROM_MBC5_RUMBLE_RAM_BATTERY = 0x1E,
 	};
 
 	enum ROM_SIZE
@@ -24,6 +38,7 @@ namespace gameboy
 		ROM_1MB,
 		ROM_2MB,
 		ROM_4MB,
+		ROM_8MB,
 	};
 
 	enum RAM_SIZE
@@ -32,10 +47,49 @@ namespace gameboy
 		RAM_2KB,
 		RAM_8KB,
 		RAM_32KB,
+		RAM_128KB,
+		RAM_64KB,
 	};
 
 	namespace mbc
 	{
+		inline bool has_battery(CATRIDGE_TYPE type)
+		{
+			switch (type)
+			{
+			case ROM_MBC1_RAM_BATTERY:
+			case ROM_MBC2_BATTERY:
+			case ROM_RAM_BATTERY:
+			case ROM_MBC3_TIMER_BATTERY:
+			case ROM_MBC3_TIMER_RAM_BATTERY:
+			case ROM_MBC3_RAM_BATTERY:
+			case ROM_MBC5_RAM_BATTERY:
+			case ROM_MBC5_RUMBLE_RAM_BATTERY:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		// number of 8KB external ram banks
+		inline u32 get_ram_bank_count(RAM_SIZE ramsize)
+		{
+			switch (ramsize)
+			{
+			case RAM_2KB:
+			case RAM_8KB:
+				return 1;
+			case RAM_32KB:
+				return 4;
+			case RAM_128KB:
+				return 16;
+			case RAM_64KB:
+				return 8;
+			default:
+				return 0;
+			}
+		}
+
 		u8 memory[0x10000]; // cover memory maps up to index 0xFFFF
 
 		u8* memory_rom;
@@ -47,51 +101,5 @@ namespace gameboy
 		u8* memory_io_registers;
 		u8* memory_zero_page;
 		u8* memory_interrupt_flag;
-		
-		int initialize(ROM_SIZE romsize, RAM_SIZE ramsize, u8* romdata, u64 datasize)
-		{
-			memset(memory, 0x0, sizeof(memory));
-
-			// copy in the rom data
-			assert(datasize <= 0x8000);
-			
-			memcpy(memory, romdata, datasize);
-
-			memory_rom = &memory[0x0000];
-			memory_switchable_rom = &memory[0x4000];
-			memory_vram = &memory[0x8000];
-			memory_external_ram = &memory[0xA000];
-			memory_working_ram = &memory[0xC000];
-			memory_oam = &memory[0xFE00];
-			memory_io_registers = &memory[0xFF00];
-			memory_zero_page = &memory[0xFF80];
-			memory_interrupt_flag = &memory[0xFFFF];
-			
-			return 0;
-		}
-
-		int reset()
-		{
-			memset(memory, 0x0, sizeof(memory));
-
-			return 0;
-		}
-
-		bool write_memory(u16 addr, u8 value)
-		{
-			return false;
-		}
-
-		int get_rom_bank_idx()
-		{
-			return 1;
-		}
-
-
-		// function pointers for mbc
-		int(*mbc_initialize)(ROM_SIZE romsize, RAM_SIZE ramsize, u8* romdata, u64 datasize) = &initialize;
-		int(*mbc_reset)() = &reset;
-		bool(*mbc_write_memory)(u16 addr, u8 value) = &write_memory;
-		int(*mbc_get_rom_bank_idx)() = &get_rom_bank_idx;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "defines.h"
+#include "mbc.h"
+#include "save_ram.h"
+
+namespace gameboy
+{
+	namespace memory_module
+	{
+		extern void enable_external_ram(bool enable);
+		extern void update_page_table_addr(u16 addr);
+	}
+
+	// memory bank controller. the base class is a cartridge without a controller. controllers switch banks by
+	// repointing mbc::memory_switchable_rom and mbc::memory_external_ram and rebuilding the pages, so rom and ram
+	// reads and writes stay on the page table fast path
+	struct mbc_base
+	{
+		std::vector<u8*> rom_banks; // point into the loaded rom image
+		std::vector<u8*> ram_banks; // point into ram_data
+		u8* ram_data = nullptr; // heap buffer, or the mapped .sav file for battery backed ram
+
+		virtual ~mbc_base() {}
+
+		virtual int initialize(ROM_SIZE romsize, RAM_SIZE ramsize, u8* romdata, u64 datasize)
+		{
+			map_fixed_memory();
+			create_rom_banks(romdata, datasize);
+			create_ram_banks(mbc::get_ram_bank_count(ramsize) * 0x2000);
+
+			mbc::memory_rom = rom_banks[0x0];
+			mbc::memory_switchable_rom = rom_banks[0x1];
+			mbc::memory_external_ram = get_ram_bank(0x0);
+
+			// without a controller there is no ram enable register. the ram is always mapped
+			if (!ram_banks.empty())
+			{
+				enable_ram(true);
+			}
+
+			return 0;
+		}
+
+		virtual int reset()
+		{
+			memset(mbc::memory, 0x0, sizeof(mbc::memory));
+
+			enable_ram(false);
+
+			rom_banks.clear();
+			ram_banks.clear();
+
+			if (ram_data && ram_data == save_ram::data)
+			{
+				save_ram::close();
+			}
+			else
+			{
+				delete[] ram_data;
+			}
+
+			ram_data = nullptr;
+
+			return 0;
+		}
+
+		// bank register writes. returns true if the controller handled the write
+		virtual bool write_memory(u16 addr, u8 value)
+		{
+			return false;
+		}
+
+		// external ram reads that are not plain memory, like the mbc3 clock. only called on the slow path
+		virtual bool read_memory(u16 addr, u8& value)
+		{
+			return false;
+		}
+
+		virtual u32 get_rom_bank_idx()
+		{
+			return 1;
+		}
+
+		void map_fixed_memory()
+		{
+			mbc::memory_vram = &mbc::memory[0x8000];
+			mbc::memory_external_ram = &mbc::memory[0xA000];
+			mbc::memory_working_ram = &mbc::memory[0xC000];
+			mbc::memory_oam = &mbc::memory[0xFE00];
+			mbc::memory_io_registers = &mbc::memory[0xFF00];
+			mbc::memory_zero_page = &mbc::memory[0xFF80];
+			mbc::memory_interrupt_flag = &mbc::memory[0xFFFF];
+		}
+
+		void create_rom_banks(u8* romdata, u64 datasize)
+		{
+			// banks are read in place. a rom shorter than 32KB is copied so the unused space reads 0
+			if (datasize < 0x8000)
+			{
+				memcpy(mbc::memory, romdata, (size_t)datasize);
+				rom_banks.push_back(&mbc::memory[0x0000]);
+				rom_banks.push_back(&mbc::memory[0x4000]);
+				return;
+			}
+
+			u64 num_banks = datasize / 0x4000;
+			for (u32 i = 0; i < num_banks; i++)
+			{
+				rom_banks.push_back(romdata + i * 0x4000);
+			}
+		}
+
+		// ram_size bytes of external ram in 8KB banks. a smaller ram still gets a whole bank as the 0xA000 page maps 8KB
+		void create_ram_banks(u32 ram_size)
+		{
+			if (ram_size == 0)
+			{
+				return;
+			}
+
+			if (save_ram::has_battery())
+			{
+				ram_data = save_ram::open(ram_size);
+			}
+
+			if (ram_data == nullptr)
+			{
+				ram_data = new u8[ram_size]();
+			}
+
+			for (u32 offset = 0; offset < ram_size; offset += 0x2000)
+			{
+				ram_banks.push_back(ram_data + offset);
+			}
+		}
+
+		// bank numbers past the end wrap like the unused address lines on the cartridge
+		inline u8* get_rom_bank(u32 idx)
+		{
+			return rom_banks[idx % rom_banks.size()];
+		}
+
+		inline u8* get_ram_bank(u32 idx)
+		{
+			if (ram_banks.empty())
+			{
+				return &mbc::memory[0xA000];
+			}
+
+			return ram_banks[idx % ram_banks.size()];
+		}
+
+		void select_rom_bank(u32 idx)
+		{
+			mbc::memory_switchable_rom = get_rom_bank(idx);
+			memory_module::update_page_table_addr(0x4000);
+		}
+
+		void select_ram_bank(u32 idx)
+		{
+			mbc::memory_external_ram = get_ram_bank(idx);
+			memory_module::update_page_table_addr(0xA000);
+		}
+
+		void enable_ram(bool enable)
+		{
+			memory_module::enable_external_ram(enable);
+		}
+	};
+
+	namespace mbc
+	{
+		mbc_base rom_only;
+		mbc_base* controller = &rom_only; // set by the rom from the cartridge type
+	}
+}
\ No newline at end of file
@@ -1,16 +1,11 @@
 #pragma once
 
 #include "defines.h"
-#include "mbc.h"
+#include "mbc_base.h"
 
 namespace gameboy
-{	
-	namespace memory_module
-	{
-		extern void enable_external_ram(bool enable);
-	}
-
-	namespace mbc_mbc1
+{
+	struct mbc_mbc1 : mbc_base
 	{
 		enum MODE_SELECT
 		{
@@ -21,86 +16,24 @@ namespace gameboy
 		MODE_SELECT mode_select;
 		u8 rom_bank_idx;
 		u8 ram_bank_idx;
-		std::vector<u8*> rom_banks;
-		std::vector<u8*> ram_banks;
 
 		int initialize(ROM_SIZE romsize, RAM_SIZE ramsize, u8* romdata, u64 datasize)
 		{
-			mbc::memory_rom = &mbc::memory[0x0000];
-			mbc::memory_switchable_rom = &mbc::memory[0x4000];
-			mbc::memory_vram = &mbc::memory[0x8000];
-			mbc::memory_external_ram = &mbc::memory[0xA000];
-			mbc::memory_working_ram = &mbc::memory[0xC000];
-			mbc::memory_oam = &mbc::memory[0xFE00];
-			mbc::memory_io_registers = &mbc::memory[0xFF00];
-			mbc::memory_zero_page = &mbc::memory[0xFF80];
-			mbc::memory_interrupt_flag = &mbc::memory[0xFFFF];
-
-			u32 banksize = 0x4000;
-
-			// copy in the static rom bank
-			u8* rom_ptr = romdata;
-
-			// based on the size, create and copy the rom banks
-			u64 num_banks = datasize / banksize;
-			for (u32 i = 0; i < num_banks; i++)
-			{
-				u8* bank = new u8[banksize];
-				memcpy(bank, rom_ptr, banksize);
-				rom_banks.push_back(bank);
+			map_fixed_memory();
 
-				rom_ptr += banksize;
-			}
+			// banks are read in place. switching a bank only moves the switchable rom pointer
+			create_rom_banks(romdata, datasize);
 
 			// point rom to default bank
 			mode_select = MODE_ROM_BANK;
 			rom_bank_idx = 0x1;
 			mbc::memory_rom = rom_banks[0x0];
-			mbc::memory_switchable_rom = rom_banks[0x1];
+			mbc::memory_switchable_rom = get_rom_bank(rom_bank_idx);
 
 			// based on the ram setting. create external ram banks
-			switch (ramsize)
-			{
-			case RAM_NONE:
-			case RAM_2KB:
-			case RAM_8KB:
-				ram_bank_idx = 0x0;
-				mbc::memory_external_ram = &mbc::memory[0xA000];
-				break;
-			default:
-				banksize = 0x2000;
-				for (u32 i = 0; i < 4; i++)
-				{
-					u8* bank = new u8[banksize];
-					memcpy(bank, 0x0, banksize);
-					ram_banks.push_back(bank);
-				}
-
-				ram_bank_idx = 0x0;
-				mbc::memory_external_ram = ram_banks[ram_bank_idx];
-				break;
-			}
-
-			return 0;
-		}
-
-		int reset()
-		{
-			mbc::reset();
-
-			while (!rom_banks.empty())
-			{
-				u8* temp = rom_banks.back();
-				rom_banks.pop_back();
-				delete[] temp;
-			}
-
-			while (!ram_banks.empty())
-			{
-				u8* temp = ram_banks.back();
-				ram_banks.pop_back();
-				delete[] temp;
-			}
+			ram_bank_idx = 0x0;
+			create_ram_banks(mbc::get_ram_bank_count(ramsize) * 0x2000);
+			mbc::memory_external_ram = get_ram_bank(ram_bank_idx);
 
 			return 0;
 		}
@@ -111,17 +44,8 @@ namespace gameboy
 
 			if (addr < 0x2000)
 			{
-				u8 val = value & 0xF;
-
-				if (val == 0xA)
-				{
-					// enable external ram
-					memory_module::enable_external_ram(true);
-				}
-				else
-				{
-					memory_module::enable_external_ram(false);
-				}
+				// enable external ram
+				enable_ram((value & 0xF) == 0xA);
 
 				handled = true;
 			}
@@ -133,12 +57,12 @@ namespace gameboy
 				{
 					val = 0x1; // cant be 0
 				}
-				
+
 				rom_bank_idx &= 0xE0; // clear lower 5 bits
 				rom_bank_idx |= val;
-				
+
 				//printf("Rom bank: %d\n", rom_bank_idx);
-				mbc::memory_switchable_rom = rom_banks[rom_bank_idx];
+				select_rom_bank(rom_bank_idx);
 
 				handled = true;
 			}
@@ -153,7 +77,7 @@ namespace gameboy
 					rom_bank_idx |= (bits << 5);
 
 					//printf("Rom bank: %d\n", rom_bank_idx);
-					mbc::memory_switchable_rom = rom_banks[rom_bank_idx];
+					select_rom_bank(rom_bank_idx);
 
 					handled = true;
 				}
@@ -161,8 +85,7 @@ namespace gameboy
 				{
 					// two bits are the ram bank
 					ram_bank_idx = bits;
-
-					mbc::memory_external_ram = ram_banks[ram_bank_idx];
+					select_ram_bank(ram_bank_idx);
 
 					handled = true;
 				}
@@ -176,12 +99,12 @@ namespace gameboy
 				{
 					if (mode == MODE_ROM_BANK)
 					{
-						mbc::memory_external_ram = ram_banks[0x0];
+						select_ram_bank(0x0);
 					}
 					else
 					{
 						// in RAM mode only ROM banks 0x0 - 0x1F can be used
-						mbc::memory_external_ram = ram_banks[ram_bank_idx];
+						select_ram_bank(ram_bank_idx);
 					}
 
 					mode_select = mode;
@@ -193,7 +116,7 @@ namespace gameboy
 			return handled;
 		}
 
-		int get_rom_bank_idx()
+		u32 get_rom_bank_idx()
 		{
 			return rom_bank_idx;
 		}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "defines.h"
+#include "mbc_base.h"
+
+namespace gameboy
+{
+	// mbc2 has 512 x 4 bit ram built in. it is not byte memory so it has no pages and is read and written through
+	// the controller on the slow path
+	struct mbc_mbc2 : mbc_base
+	{
+		static const u32 ram_size = 0x200;
+
+		u8 rom_bank_idx;
+		bool ram_enabled;
+
+		int initialize(ROM_SIZE romsize, RAM_SIZE ramsize, u8* romdata, u64 datasize)
+		{
+			map_fixed_memory();
+			create_rom_banks(romdata, datasize);
+
+			rom_bank_idx = 0x1;
+			mbc::memory_rom = rom_banks[0x0];
+			mbc::memory_switchable_rom = get_rom_bank(rom_bank_idx);
+
+			// one nibble per byte. the header ram size is 0 for mbc2
+			ram_enabled = false;
+
+			if (save_ram::has_battery())
+			{
+				ram_data = save_ram::open(ram_size);
+			}
+
+			if (ram_data == nullptr)
+			{
+				ram_data = new u8[ram_size]();
+			}
+
+			mbc::memory_external_ram = nullptr;
+
+			return 0;
+		}
+
+		bool write_memory(u16 addr, u8 value)
+		{
+			if (addr < 0x4000)
+			{
+				// bit 8 of the address selects the register
+				if ((addr & 0x100) == 0)
+				{
+					ram_enabled = ((value & 0xF) == 0xA);
+				}
+				else
+				{
+					rom_bank_idx = value & 0xF;
+					if (rom_bank_idx == 0x0)
+					{
+						rom_bank_idx = 0x1; // cant be 0
+					}
+
+					select_rom_bank(rom_bank_idx);
+				}
+
+				return true;
+			}
+			else if (addr >= 0xA000 && addr < 0xC000)
+			{
+				// ram repeats through the whole range
+				if (ram_enabled)
+				{
+					ram_data[addr & (ram_size - 1)] = value & 0xF;
+					save_ram::ram_written();
+				}
+
+				return true;
+			}
+
+			return false;
+		}
+
+		bool read_memory(u16 addr, u8& value)
+		{
+			if (!ram_enabled)
+			{
+				return false;
+			}
+
+			// upper bits are not connected and read 1
+			value = 0xF0 | ram_data[addr & (ram_size - 1)];
+			return true;
+		}
+
+		u32 get_rom_bank_idx()
+		{
+			return rom_bank_idx;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,231 @@
+#pragma once
+
+#include "defines.h"
+#include "mbc_base.h"
+#include "scheduler.h"
+
+namespace gameboy
+{
+	// mbc3 has 128 rom banks, 4 ram banks and a real time clock. the clock is never ticked. its time is worked out
+	// from the emulated cycle counter when the game latches or writes it
+	struct mbc_mbc3 : mbc_base
+	{
+		enum RTC_REGISTER
+		{
+			RTC_SECONDS = 0,
+			RTC_MINUTES,
+			RTC_HOURS,
+			RTC_DAYS_LOW,
+			RTC_DAYS_HIGH,
+			RTC_COUNT
+		};
+
+		static const u64 rtc_cycles_per_second = 4194304;
+		static const u64 rtc_day_limit = 512; // day counter is 9 bits
+
+		u8 rom_bank_idx;
+		u8 ram_bank_idx; // 0x0 - 0x3 ram bank, 0x8 - 0xC clock register
+		bool ram_enabled;
+
+		u64 rtc_seconds; // clock time at rtc_cycles
+		u64 rtc_cycles;
+		bool rtc_halted;
+		bool rtc_day_carry;
+		u8 rtc_latched[RTC_COUNT]; // registers as the game reads them
+		u8 rtc_latch_value;
+
+		int initialize(ROM_SIZE romsize, RAM_SIZE ramsize, u8* romdata, u64 datasize)
+		{
+			map_fixed_memory();
+
+			// banks are read in place. switching a bank only moves the switchable rom pointer
+			create_rom_banks(romdata, datasize);
+
+			rom_bank_idx = 0x1;
+			mbc::memory_rom = rom_banks[0x0];
+			mbc::memory_switchable_rom = get_rom_bank(rom_bank_idx);
+
+			ram_bank_idx = 0x0;
+			ram_enabled = false;
+			create_ram_banks(mbc::get_ram_bank_count(ramsize) * 0x2000);
+			mbc::memory_external_ram = get_ram_bank(ram_bank_idx);
+
+			rtc_seconds = 0;
+			rtc_cycles = scheduler::cycles;
+			rtc_halted = false;
+			rtc_day_carry = false;
+			rtc_latch_value = 0xFF;
+			memset(rtc_latched, 0x0, sizeof(rtc_latched));
+
+			return 0;
+		}
+
+		// fold the whole seconds run since rtc_cycles into the clock. the part of a second stays in rtc_cycles
+		void update_rtc()
+		{
+			if (!rtc_halted)
+			{
+				u64 elapsed = (scheduler::cycles - rtc_cycles) / rtc_cycles_per_second;
+				rtc_seconds += elapsed;
+				rtc_cycles += elapsed * rtc_cycles_per_second;
+			}
+
+			if (rtc_seconds >= rtc_day_limit * 86400)
+			{
+				rtc_day_carry = true;
+				rtc_seconds %= rtc_day_limit * 86400;
+			}
+		}
+
+		u8 get_rtc_register(u8 reg)
+		{
+			u64 days = rtc_seconds / 86400;
+
+			switch (reg)
+			{
+			case RTC_SECONDS:
+				return rtc_seconds % 60;
+			case RTC_MINUTES:
+				return (rtc_seconds / 60) % 60;
+			case RTC_HOURS:
+				return (rtc_seconds / 3600) % 24;
+			case RTC_DAYS_LOW:
+				return days & 0xFF;
+			case RTC_DAYS_HIGH:
+				return ((days >> 8) & 0x1) | (rtc_halted ? 0x40 : 0x0) | (rtc_day_carry ? 0x80 : 0x0);
+			default:
+				return 0xFF;
+			}
+		}
+
+		void set_rtc_register(u8 reg, u8 value)
+		{
+			update_rtc();
+
+			u64 seconds = rtc_seconds % 60;
+			u64 minutes = (rtc_seconds / 60) % 60;
+			u64 hours = (rtc_seconds / 3600) % 24;
+			u64 days = rtc_seconds / 86400;
+
+			switch (reg)
+			{
+			case RTC_SECONDS:
+				seconds = value & 0x3F;
+				rtc_cycles = scheduler::cycles; // writing the seconds restarts the current second
+				break;
+			case RTC_MINUTES:
+				minutes = value & 0x3F;
+				break;
+			case RTC_HOURS:
+				hours = value & 0x1F;
+				break;
+			case RTC_DAYS_LOW:
+				days = (days & 0x100) | value;
+				break;
+			case RTC_DAYS_HIGH:
+				days = (days & 0xFF) | ((value & 0x1) << 8);
+				rtc_day_carry = ((value & 0x80) != 0);
+
+				if (rtc_halted && (value & 0x40) == 0)
+				{
+					rtc_cycles = scheduler::cycles; // no time passed while halted
+				}
+
+				rtc_halted = ((value & 0x40) != 0);
+				break;
+			}
+
+			rtc_seconds = days * 86400 + hours * 3600 + minutes * 60 + seconds;
+		}
+
+		void latch_rtc()
+		{
+			update_rtc();
+
+			for (u8 i = 0; i < RTC_COUNT; i++)
+			{
+				rtc_latched[i] = get_rtc_register(i);
+			}
+		}
+
+		bool write_memory(u16 addr, u8 value)
+		{
+			if (addr < 0x2000)
+			{
+				// enable external ram and clock registers
+				ram_enabled = ((value & 0xF) == 0xA);
+				enable_ram(ram_enabled);
+				return true;
+			}
+			else if (addr < 0x4000)
+			{
+				// 7 bit rom bank
+				rom_bank_idx = value & 0x7F;
+				if (rom_bank_idx == 0x0)
+				{
+					rom_bank_idx = 0x1; // cant be 0
+				}
+
+				select_rom_bank(rom_bank_idx);
+				return true;
+			}
+			else if (addr < 0x6000)
+			{
+				ram_bank_idx = value & 0xF;
+
+				if (ram_bank_idx < 0x4)
+				{
+					select_ram_bank(ram_bank_idx);
+				}
+				else
+				{
+					// clock registers are not memory. no pages so accesses reach the controller
+					mbc::memory_external_ram = nullptr;
+					memory_module::update_page_table_addr(0xA000);
+				}
+
+				return true;
+			}
+			else if (addr < 0x8000)
+			{
+				// writing 0 then 1 copies the clock into the latched registers
+				if (rtc_latch_value == 0x0 && value == 0x1)
+				{
+					latch_rtc();
+				}
+
+				rtc_latch_value = value;
+				return true;
+			}
+			else if (addr >= 0xA000 && addr < 0xC000 && ram_enabled && ram_bank_idx >= 0x8)
+			{
+				if (ram_bank_idx <= 0xC)
+				{
+					u8 reg = ram_bank_idx - 0x8;
+					set_rtc_register(reg, value);
+					rtc_latched[reg] = get_rtc_register(reg);
+				}
+
+				return true;
+			}
+
+			return false;
+		}
+
+		bool read_memory(u16 addr, u8& value)
+		{
+			if (!ram_enabled || ram_bank_idx < 0x8)
+			{
+				return false;
+			}
+
+			value = (ram_bank_idx <= 0xC ? rtc_latched[ram_bank_idx - 0x8] : 0xFF);
+			return true;
+		}
+
+		u32 get_rom_bank_idx()
+		{
+			return rom_bank_idx;
+		}
+	};
+}
\ No newline at end of file
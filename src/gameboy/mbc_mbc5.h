@@ -0,0 +1,74 @@
+#pragma once
+
+#include "defines.h"
+#include "mbc_base.h"
+
+namespace gameboy
+{
+	// mbc5 addresses up to 512 rom banks and 16 ram banks. bank 0 can be mapped into the switchable bank
+	struct mbc_mbc5 : mbc_base
+	{
+		u16 rom_bank_idx;
+		u8 ram_bank_idx;
+
+		int initialize(ROM_SIZE romsize, RAM_SIZE ramsize, u8* romdata, u64 datasize)
+		{
+			map_fixed_memory();
+
+			// banks are read in place. switching a bank only moves the switchable rom pointer
+			create_rom_banks(romdata, datasize);
+
+			rom_bank_idx = 0x1;
+			mbc::memory_rom = rom_banks[0x0];
+			mbc::memory_switchable_rom = get_rom_bank(rom_bank_idx);
+
+			ram_bank_idx = 0x0;
+			create_ram_banks(mbc::get_ram_bank_count(ramsize) * 0x2000);
+			mbc::memory_external_ram = get_ram_bank(ram_bank_idx);
+
+			return 0;
+		}
+
+		bool write_memory(u16 addr, u8 value)
+		{
+			if (addr < 0x2000)
+			{
+				// enable external ram. mbc5 checks the whole byte
+				enable_ram(value == 0x0A);
+				return true;
+			}
+			else if (addr < 0x3000)
+			{
+				// lower 8 bits of rom bank
+				rom_bank_idx = (rom_bank_idx & 0x100) | value;
+				select_rom_bank(rom_bank_idx);
+				return true;
+			}
+			else if (addr < 0x4000)
+			{
+				// bit 8 of rom bank
+				rom_bank_idx = (rom_bank_idx & 0xFF) | ((value & 0x1) << 8);
+				select_rom_bank(rom_bank_idx);
+				return true;
+			}
+			else if (addr < 0x6000)
+			{
+				// ram bank. bit 3 drives the rumble motor on rumble cartridges
+				ram_bank_idx = value & 0xF;
+				select_ram_bank(ram_bank_idx);
+				return true;
+			}
+			else if (addr < 0x8000)
+			{
+				return true;
+			}
+
+			return false;
+		}
+
+		u32 get_rom_bank_idx()
+		{
+			return rom_bank_idx;
+		}
+	};
+}
\ No newline at end of file
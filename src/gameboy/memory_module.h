@@ -2,18 +2,41 @@
 
 #include "defines.h"
 #include "rom.h"
+#include "mbc_base.h"
 #include "boot_rom.h"
+#include "input.h"
+#include "scheduler.h"
+#include "memory_stats.h"
 
 #include <cstdarg>
 
-//#include "mbc_base.h"
-
 namespace gameboy
 {
 	namespace cpu
 	{
-		void reset_timer_counter();
+		void update_timer_control(u8 old_controller);
 		int update_timer(u8 cycles);
+		u8 read_divider();
+		void reset_divider();
+		u8 read_timer();
+		void timer_catch_up(u64 until_cycles);
+		void schedule_timer_overflow();
+	}
+
+	namespace gpu
+	{
+		void lcd_register_written();
+		void palette_written(u16 addr, u8 value);
+		void lcd_memory_written(u16 addr, u8 value);
+		void catch_up(u64 until_cycles);
+		void interrupt_enable_written();
+	}
+
+	namespace block_cache
+	{
+		void invalidate_page(u8 page);
+		u32 invalidate(u16 addr_min, u16 addr_max);
+		void flush();
 	}
 	
 	namespace memory_module
@@ -63,9 +86,120 @@ namespace gameboy
 			{ "INTF", nullptr, 0xFFFF, 0xFFFF, MEMORY_READABLE | MEMORY_WRITABLE },
 		};
 
+		// page tables. one entry per 256 byte page pointing directly at the backing memory. a null entry takes the slow path
+		u8* read_page_table[0x100];
+		u8* write_page_table[0x100];
+		u32 page_table_generation = 0; // changes whenever a page is remapped. the block executor stops on a change
+
+		// boot rom covers the first rom page until it is unloaded through 0xFF50
+		bool boot_rom_mapped = false;
+
+		// ram pages holding cached cpu blocks. writes to them take the slow path and drop the blocks
+		bool code_pages[0x100];
+
+		// oam dma takes 160 m-cycles. oam is on the dma bus until the transfer ends, so the bytes are copied in bulk at
+		// the end. only a change to the source can be seen early. writes to the source page and bank switches take the
+		// slow path during the transfer and catch the copy up to the current cycle first
+		const u32 dma_length = 0xA0;
+		const u32 dma_cycles_per_byte = 4;
+
+		bool dma_active = false;
+		u16 dma_source;
+		u8 dma_source_page; // page writes are watched on. echo ram sources watch the working ram page
+		u64 dma_start_cycles;
+		u32 dma_bytes_done;
+
+		// vram reads and writes take the slow path. the lcd mode they are allowed in is worked out when they are made
+		// and the lcd logs the writes made while it captures a frame
+		inline bool is_vram_page(u32 page)
+		{
+			return page >= 0x80 && page < 0xA0;
+		}
+
+		// vram and oam. the lcd is brought up to date before they are accessed
+		inline bool is_lcd_memory(u16 addr)
+		{
+			return (addr >= 0x8000 && addr < 0xA000) || (addr >= 0xFE00 && addr < 0xFEA0);
+		}
+
+		void update_page_table(u8 map_idx)
+		{
+			memory_map_object* map = &memory_map[map_idx];
+			u8* base = (map->memory_ptr ? *map->memory_ptr : nullptr);
+
+			for (u32 page = (map->addr_min >> 8); page <= (u32)(map->addr_max >> 8); page++)
+			{
+				u8* page_ptr = nullptr;
+
+				// oam and io pages are shared with other maps and registers with side effects. always go through slow path
+				if (base && page < 0xFE)
+				{
+					page_ptr = &base[(page << 8) - map->addr_min];
+				}
+
+				if (page == 0x0 && boot_rom_mapped)
+				{
+					page_ptr = boot_ptr->romdata;
+				}
+
+				read_page_table[page] = ((map->access & MEMORY_READABLE) && !is_vram_page(page) ? page_ptr : nullptr);
+				write_page_table[page] = ((map->access & MEMORY_WRITABLE) && !code_pages[page] && !is_vram_page(page) && !(dma_active && page == dma_source_page) &&
+					!(save_ram::watch_writes && map_idx == MEMORY_EXTERNAL_RAM) ? page_ptr : nullptr);
+			}
+
+			page_table_generation++;
+		}
+
+		void update_page_table()
+		{
+			for (u8 i = 0; i < MEMORY_COUNT; i++)
+			{
+				update_page_table(i);
+			}
+		}
+
+		void update_page_table_addr(u16 addr) // rebuild the pages of the map containing addr. used by the mbc on bank switches
+		{
+			for (u8 i = 0; i < MEMORY_COUNT; i++)
+			{
+				if (addr <= memory_map[i].addr_max)
+				{
+					update_page_table(i);
+					return;
+				}
+			}
+		}
+
+		void protect_code_page(u8 page)
+		{
+			code_pages[page] = true;
+			write_page_table[page] = nullptr;
+		}
+
+		void code_page_written(u16 addr)
+		{
+			// io registers share the zero page, so every write to it takes the slow path anyway. the page stays protected
+			// and only the blocks holding the written byte are dropped. the block executor stops if it ran one
+			u8 page = (addr >> 8);
+			if (page == 0xFF)
+			{
+				if (addr >= 0xFF80 && block_cache::invalidate(addr, addr) > 0)
+				{
+					page_table_generation++;
+				}
+
+				return;
+			}
+
+			code_pages[page] = false;
+			block_cache::invalidate_page(page);
+			update_page_table_addr(addr);
+		}
+
 		void enable_external_ram(bool enable)
 		{
 			memory_map[MEMORY_EXTERNAL_RAM].access = (enable ? MEMORY_READABLE | MEMORY_WRITABLE : 0);
+			update_page_table(MEMORY_EXTERNAL_RAM);
 		}
 
 		memory_map_object* find_map(u16 addr)
@@ -82,12 +216,29 @@ namespace gameboy
 			return nullptr;
 		}
 
-		inline void set_memory_access(u8 bank, u8 access) { memory_map[bank].access = access; }
+		inline void set_memory_access(u8 bank, u8 access)
+		{
+			if (memory_map[bank].access != access)
+			{
+				memory_map[bank].access = access;
+
+				// vram and oam have no pages. the lcd changes their access every mode without touching the page tables
+				if (bank != MEMORY_VRAM && bank != MEMORY_OAM)
+				{
+					update_page_table(bank);
+				}
+			}
+		}
+
 		inline u8 get_memory_access(u8 bank, u8 access) { return memory_map[bank].access; }
 
 		bool show_warnings = true;
 		void disable_warnings() { show_warnings = false; }
 		void enable_warnings() { show_warnings = true; }
+
+		// headless runs keep battery backed ram in memory. they never create or change the rom's .sav file
+		bool battery_saves = true;
+		void disable_battery_saves() { battery_saves = false; }
 		
 		void print_warning(const char* str, ...)
 		{
@@ -100,7 +251,7 @@ namespace gameboy
 			}
 		}
 
-		u8* get_memory(u16 addr, bool force = false)
+		u8* get_memory_slow(u16 addr, bool force)
 		{
 			// loop though memory map
 			for (unsigned int i = 0; i < MEMORY_COUNT; i++)
@@ -116,7 +267,7 @@ namespace gameboy
 						}
 					}
 					
-					if (memory_map[i].memory_ptr == nullptr)
+					if (memory_map[i].memory_ptr == nullptr || *memory_map[i].memory_ptr == nullptr)
 					{
 						return 0;
 					}
@@ -129,8 +280,59 @@ namespace gameboy
 			return 0;
 		}
 
-		u8 read_memory(u16 addr, bool force = false)
+		u8* get_memory(u16 addr, bool force = false)
+		{
+			u8* page = read_page_table[addr >> 8];
+			if (page)
+			{
+				return &page[addr & 0xFF];
+			}
+
+			return get_memory_slow(addr, force);
+		}
+
+		u8 read_memory_slow(u16 addr, bool force)
 		{
+			if (addr == 0xFF00) // joypad. key bits come from the current input state
+			{
+				return get_joypad_register(mbc::memory[addr]);
+			}
+
+			// divider and timer are worked out from the cycle counter. idle loop skipping stops in front of a change to
+			// the lazy state the loop reads
+			if (addr == 0xFF04)
+			{
+				scheduler::lazy_state_read(scheduler::LAZY_DIVIDER);
+				return cpu::read_divider();
+			}
+
+			if (addr == 0xFF05)
+			{
+				scheduler::lazy_state_read(scheduler::LAZY_TIMER);
+				return cpu::read_timer();
+			}
+
+			// stat, ly, the vram and oam access and the lcd interrupt request bits follow the lcd
+			if (is_lcd_memory(addr) || addr == 0xFF41 || addr == 0xFF44 || addr == 0xFF0F || addr == 0xFFFF)
+			{
+				scheduler::lazy_state_read(scheduler::LAZY_LCD);
+				gpu::catch_up(scheduler::cycles);
+			}
+
+			if (dma_active && addr >= 0xFE00 && addr < 0xFEA0) // oam is on the dma bus during the transfer
+			{
+				return 0xFF;
+			}
+
+			if (addr >= 0xA000 && addr < 0xC000) // external ram the controller answers itself, like the mbc3 clock
+			{
+				u8 value;
+				if (mbc::controller->read_memory(addr, value))
+				{
+					return value;
+				}
+			}
+
 			// loop though memory map
 			for (unsigned int i = 0; i < MEMORY_COUNT; i++)
 			{
@@ -158,46 +360,245 @@ namespace gameboy
 			return 0;
 		}
 
-		void write_memory(const u16 addr, const u8* value, const u8 size, bool force = false)
+		inline u8 read_memory(u16 addr, bool force = false)
 		{
-			if (mbc::mbc_write_memory(addr, *value)) // if memory controller handles addr, return here
+#ifdef MEMORY_STATS
+			if (!force)
 			{
-				return;
+				memory_stats::count_read(addr);
 			}
+#endif
 
-			if (addr == 0xFF44) // current scanline. if anyone tries to write to this value we reset to 0
+			u8* page = read_page_table[addr >> 8];
+			if (page)
 			{
-				mbc::memory[addr] = 0x0;
-				return;
+				return page[addr & 0xFF];
 			}
-			else if (addr == 0xFF04) // divide register is reset if someone tries to write to it
+
+			return read_memory_slow(addr, force);
+		}
+
+		// io register writes go through a handler per register. registers without side effects just store the value
+		typedef void(*io_write_handler)(u16 addr, u8 value);
+		io_write_handler io_write_handlers[0x80];
+
+		void write_io_register(u16 addr, u8 value)
+		{
+			mbc::memory[addr] = value;
+		}
+
+		void write_divider(u16 addr, u8 value)
+		{
+			// divide register is reset if someone tries to write to it
+			cpu::reset_divider();
+		}
+
+		void write_timer(u16 addr, u8 value)
+		{
+			// timer and modulator. the ticks so far count with the old values and the overflow is worked out again
+			cpu::timer_catch_up(scheduler::cycles);
+			mbc::memory[addr] = value;
+			cpu::schedule_timer_overflow();
+		}
+
+		void write_timer_controller(u16 addr, u8 value)
+		{
+			// check if frequency has changed and reset timer if so
+			cpu::timer_catch_up(scheduler::cycles);
+			u8 timer_controller = mbc::memory[addr];
+			mbc::memory[addr] = value;
+
+			cpu::update_timer_control(timer_controller); // reschedules the timer event
+		}
+
+		void write_interrupt_request(u16 addr, u8 value)
+		{
+			// the lcd sets its request bits when it catches up. they are brought in before the write replaces them
+			gpu::catch_up(scheduler::cycles);
+			mbc::memory[addr] = value;
+		}
+
+		void write_lcd_register(u16 addr, u8 value)
+		{
+			// lcd control, stat and lyc. the lcd event re-evaluates on the next cycle
+			gpu::catch_up(scheduler::cycles);
+			mbc::memory[addr] = value;
+			gpu::lcd_register_written();
+		}
+
+		void write_lcd_line_register(u16 addr, u8 value)
+		{
+			// scroll and window position. the lcd captures them per line, so the lines passed so far keep the old value
+			gpu::catch_up(scheduler::cycles);
+			mbc::memory[addr] = value;
+		}
+
+		void write_palette(u16 addr, u8 value)
+		{
+			// bgp, obp0 and obp1. the lcd keeps them as shade tables
+			gpu::catch_up(scheduler::cycles);
+			mbc::memory[addr] = value;
+			gpu::palette_written(addr, value);
+		}
+
+		void write_scanline(u16 addr, u8 value)
+		{
+			// current scanline. if anyone tries to write to this value we reset to 0
+			gpu::catch_up(scheduler::cycles);
+			mbc::memory[addr] = 0x0;
+			gpu::lcd_register_written();
+		}
+
+		// copy the transfer up to count bytes. the source is read through the page tables, so a rom bank switched in
+		// during the transfer is copied from the point of the switch
+		void dma_copy(u32 count)
+		{
+			if (count <= dma_bytes_done)
 			{
-				mbc::memory[addr] = 0x0;
 				return;
 			}
-			else if (addr == 0xFF07) // timer controller. check if frequency has changed and reset timer if so
+
+			u8* src = get_memory(dma_source + dma_bytes_done, true);
+
+			for (u32 i = dma_bytes_done; i < count; i++)
+			{
+				gpu::lcd_memory_written(0xFE00 + i, src ? src[i - dma_bytes_done] : 0xFF);
+			}
+
+			if (src)
+			{
+				memcpy(&mbc::memory[0xFE00 + dma_bytes_done], src, count - dma_bytes_done);
+			}
+			else
+			{
+				memset(&mbc::memory[0xFE00 + dma_bytes_done], 0xFF, count - dma_bytes_done);
+			}
+
+			dma_bytes_done = count;
+		}
+
+		// bring oam up to date with the current cycle. called before anything observes oam or the source
+		inline void dma_catch_up()
+		{
+			if (dma_active)
+			{
+				gpu::catch_up(scheduler::cycles); // the copied bytes are logged against the line the lcd is on
+
+				u64 bytes = (scheduler::cycles - dma_start_cycles) / dma_cycles_per_byte;
+				dma_copy(bytes < dma_length ? (u32)bytes : dma_length);
+			}
+		}
+
+		void dma_stop()
+		{
+			dma_active = false;
+			update_page_table_addr(dma_source_page << 8); // writes to the source page take the fast path again
+		}
+
+		void dma_event(u64 event_cycles)
+		{
+			gpu::catch_up(event_cycles);
+			dma_copy(dma_length);
+			dma_stop();
+		}
+
+		void write_dma(u16 addr, u8 value)
+		{
+			// a new transfer restarts the running one. the lcd captures which lines have oam on the dma bus
+			gpu::catch_up(scheduler::cycles);
+
+			if (dma_active)
+			{
+				dma_catch_up();
+				dma_stop();
+			}
+
+			mbc::memory[addr] = value;
+
+			dma_source = (value << 8);
+			dma_source_page = (value >= 0xE0 && value < 0xFE ? value - 0x20 : value);
+			dma_start_cycles = scheduler::cycles;
+			dma_bytes_done = 0;
+			dma_active = true;
+
+			write_page_table[dma_source_page] = nullptr;
+			scheduler::schedule_event(scheduler::EVENT_DMA, dma_start_cycles + dma_length * dma_cycles_per_byte);
+		}
+
+		void write_boot_rom_unmap(u16 addr, u8 value)
+		{
+			// unload the boot rom
+			boot_rom_mapped = false;
+			update_page_table(MEMORY_CARTRIDGE_ROM);
+			block_cache::flush();
+		}
+
+		void initialize_io_write_handlers()
+		{
+			for (u8 i = 0; i < 0x80; i++)
+			{
+				io_write_handlers[i] = &write_io_register;
+			}
+
+			io_write_handlers[0x04] = &write_divider;
+			io_write_handlers[0x05] = &write_timer;
+			io_write_handlers[0x06] = &write_timer;
+			io_write_handlers[0x07] = &write_timer_controller;
+			io_write_handlers[0x0F] = &write_interrupt_request;
+			io_write_handlers[0x40] = &write_lcd_register;
+			io_write_handlers[0x41] = &write_lcd_register;
+			io_write_handlers[0x42] = &write_lcd_line_register;
+			io_write_handlers[0x43] = &write_lcd_line_register;
+			io_write_handlers[0x44] = &write_scanline;
+			io_write_handlers[0x45] = &write_lcd_register;
+			io_write_handlers[0x46] = &write_dma;
+			io_write_handlers[0x47] = &write_palette;
+			io_write_handlers[0x48] = &write_palette;
+			io_write_handlers[0x49] = &write_palette;
+			io_write_handlers[0x4A] = &write_lcd_line_register;
+			io_write_handlers[0x4B] = &write_lcd_line_register;
+			io_write_handlers[0x50] = &write_boot_rom_unmap;
+		}
+
+		void write_memory_slow(const u16 addr, const u8 value, bool force)
+		{
+			if (is_lcd_memory(addr) || addr == 0xFFFF) // the lcd plans its events around the interrupt enable register
+			{
+				gpu::catch_up(scheduler::cycles);
+			}
+
+			dma_catch_up();
+
+			if (addr >= 0xFF00 && addr < 0xFF80)
 			{
-				u8 timer_controller = mbc::memory[addr];
-				memcpy(&mbc::memory[addr], value, size);
+				io_write_handlers[addr - 0xFF00](addr, value);
+				return;
+			}
 
-				if ((timer_controller & 0x3) != (*value & 0x3)) // not equal
+			if (addr < 0x8000)
+			{
+				// rom is a read only mapping. writes are memory controller registers
+				if (!mbc::controller->write_memory(addr, value) && !force)
 				{
-					cpu::reset_timer_counter(); // reset timer
+					print_warning("Warning - writing to memory map that is not writable: 0x%X map: %d\n", addr, (addr < 0x4000 ? MEMORY_CARTRIDGE_ROM : MEMORY_CARTRIDGE_SWITCHABLE_ROM));
 				}
+
 				return;
 			}
-			else if (addr == 0xFF50)
+
+			if (addr >= 0xA000 && addr < 0xC000 && mbc::controller->write_memory(addr, value)) // external ram the controller handles itself
 			{
-				// unload the boot rom
-				memcpy(mbc::memory_rom, rom_ptr->romdata, 0x100);
 				return;
 			}
-			else if (addr == 0xFF46)
+
+			if (code_pages[addr >> 8])
+			{
+				code_page_written(addr);
+			}
+
+			if (dma_active && addr >= 0xFE00 && addr < 0xFEA0) // oam is on the dma bus during the transfer
 			{
-				// transfer OAM data
-				u16 src_addr = *value;
-				src_addr *= 0x100;
-				memcpy(&mbc::memory[0xFE00], &mbc::memory[src_addr], 0x9F);
+				return;
 			}
 
 			// loop though memory map
@@ -206,7 +607,7 @@ namespace gameboy
 				if (addr <= memory_map[i].addr_max)
 				{
 					if (!force)
-					{						
+					{
 						if ((memory_map[i].access & MEMORY_WRITABLE) == 0)
 						{
 							print_warning("Warning - writing to memory map that is not writable: 0x%X map: %d\n", addr, i);
@@ -214,12 +615,26 @@ namespace gameboy
 						}
 					}
 
-					if (memory_map[i].memory_ptr == nullptr)
+					if (memory_map[i].memory_ptr == nullptr || *memory_map[i].memory_ptr == nullptr)
 					{
 						return;
 					}
 
-					memcpy(&(*memory_map[i].memory_ptr)[addr - memory_map[i].addr_min], value, size);
+					if (is_lcd_memory(addr)) // vram and oam the lcd draws from
+					{
+						gpu::lcd_memory_written(addr, value);
+					}
+
+					(*memory_map[i].memory_ptr)[addr - memory_map[i].addr_min] = value;
+
+					if (i == MEMORY_EXTERNAL_RAM)
+					{
+						save_ram::ram_written();
+					}
+					else if (i == MEMORY_INTERRUPT_FLAG)
+					{
+						gpu::interrupt_enable_written();
+					}
 
 					return;
 				}
@@ -228,16 +643,39 @@ namespace gameboy
 			printf("Error - memory map not implemented for this range of addr: 0x%X\n", addr);
 			return;
 		}
-		
-		void write_memory(const u16 addr, const u8 value, bool force = false)
+
+		inline void write_memory(const u16 addr, const u8 value, bool force = false)
 		{
-			write_memory(addr, &value, 1, force);
+#ifdef MEMORY_STATS
+			if (!force)
+			{
+				memory_stats::count_write(addr);
+			}
+#endif
+
+			u8* page = write_page_table[addr >> 8];
+			if (page)
+			{
+				page[addr & 0xFF] = value;
+				return;
+			}
+
+			write_memory_slow(addr, value, force);
+		}
+
+		inline void write_memory(const u16 addr, const u8* value, const u8 size, bool force = false)
+		{
+			for (u8 i = 0; i < size; i++)
+			{
+				write_memory(addr + i, value[i], force);
+			}
 		}
 
 		int reset()
 		{
-			mbc::mbc_reset();
-			mbc::mbc_initialize(rom_ptr->romheader.romSize, rom_ptr->romheader.ramSize, rom_ptr->romdata, (u64)rom_ptr->romsize);
+			mbc::controller->reset();
+			save_ram::set_rom_filename(rom_ptr->filename, battery_saves && mbc::has_battery(rom_ptr->romheader.cartridgeType));
+			mbc::controller->initialize(rom_ptr->romheader.romSize, rom_ptr->romheader.ramSize, rom_ptr->romdata, (u64)rom_ptr->romsize);
 
 			memory_map[MEMORY_CARTRIDGE_ROM].memory_ptr = &mbc::memory_rom;
 			memory_map[MEMORY_CARTRIDGE_SWITCHABLE_ROM].memory_ptr = &mbc::memory_switchable_rom;
@@ -251,11 +689,22 @@ namespace gameboy
 			memory_map[MEMORY_ZERO_PAGE].memory_ptr = &mbc::memory_zero_page;
 			memory_map[MEMORY_INTERRUPT_FLAG].memory_ptr = &mbc::memory_interrupt_flag;
 
-			// copy boot rom
+			// rom banks were remapped. drop all cached code
+			memset(code_pages, 0x0, sizeof(code_pages));
+			block_cache::flush();
+
+			memory_stats::reset();
+
+			dma_active = false;
+			scheduler::set_event_handler(scheduler::EVENT_DMA, dma_event);
+
+			// map in the boot rom
+			boot_rom_mapped = (boot_ptr != nullptr);
+
+			update_page_table();
+
 			if (boot_ptr)
 			{
-				memcpy(mbc::memory_rom, boot_ptr->romdata, 0x100);
-
 				write_memory(0xFF4D, 0xFF); // KEY1 - CGB only
 				write_memory(0xFF41, 0x84); // LCDS
 			}
@@ -306,6 +755,7 @@ namespace gameboy
 			boot_ptr = boot;
 			rom_ptr = rom;
 
+			initialize_io_write_handlers();
 			reset();
 
 			return 0;
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "defines.h"
+#include "mbc_base.h"
+
+#include <cmath>
+#include <fstream>
+
+// count cpu reads and writes per 256 byte page, per io register and per rom bank. shown as a heatmap in the memory
+// debugger and written out at exit with -m. compiled out of the memory access path unless defined
+//#define MEMORY_STATS
+
+namespace gameboy
+{
+	namespace memory_stats
+	{
+#ifdef MEMORY_STATS
+		const bool enabled = true;
+#else
+		const bool enabled = false;
+#endif
+
+		u64 page_reads[0x100];
+		u64 page_writes[0x100];
+		u64 io_reads[0x80];
+		u64 io_writes[0x80];
+		std::vector<u64> rom_bank_reads; // reads of 0x0000 - 0x3FFF count to bank 0
+
+		std::string dump_filename; // written at exit if set
+
+		inline void count_read(u16 addr)
+		{
+			page_reads[addr >> 8]++;
+
+			if (addr < 0x8000)
+			{
+				u32 bank = (addr < 0x4000 ? 0 : mbc::controller->get_rom_bank_idx());
+				if (bank >= rom_bank_reads.size())
+				{
+					rom_bank_reads.resize(bank + 1, 0);
+				}
+
+				rom_bank_reads[bank]++;
+			}
+			else if (addr >= 0xFF00 && addr < 0xFF80)
+			{
+				io_reads[addr - 0xFF00]++;
+			}
+		}
+
+		// opcode bytes run from the block cache. the handlers read the operands themselves
+		inline void count_fetch(u16 addr, u8 length)
+		{
+			for (u8 i = 0; i < length; i++)
+			{
+				count_read(addr + i);
+			}
+		}
+
+		inline void count_write(u16 addr)
+		{
+			page_writes[addr >> 8]++;
+
+			if (addr >= 0xFF00 && addr < 0xFF80)
+			{
+				io_writes[addr - 0xFF00]++;
+			}
+		}
+
+		void reset()
+		{
+			memset(page_reads, 0x0, sizeof(page_reads));
+			memset(page_writes, 0x0, sizeof(page_writes));
+			memset(io_reads, 0x0, sizeof(io_reads));
+			memset(io_writes, 0x0, sizeof(io_writes));
+			rom_bank_reads.clear();
+		}
+
+		u64 get_max_page_count()
+		{
+			u64 max_count = 0;
+
+			for (u32 i = 0; i < 0x100; i++)
+			{
+				max_count = std::max(max_count, page_reads[i] + page_writes[i]);
+			}
+
+			return max_count;
+		}
+
+		u64 get_max_io_count()
+		{
+			u64 max_count = 0;
+
+			for (u32 i = 0; i < 0x80; i++)
+			{
+				max_count = std::max(max_count, io_reads[i] + io_writes[i]);
+			}
+
+			return max_count;
+		}
+
+		// 0 - 1 on a log scale, so pages hit a few times still show next to the hot loops
+		float get_heat(u64 count, u64 max_count)
+		{
+			if (count == 0 || max_count == 0)
+			{
+				return 0.0f;
+			}
+
+			return (float)(std::log((double)count + 1.0) / std::log((double)max_count + 1.0));
+		}
+
+		void dump_csv(std::ofstream& file)
+		{
+			file << "type,index,reads,writes\n";
+
+			for (u32 i = 0; i < 0x100; i++)
+			{
+				file << "page," << i << "," << page_reads[i] << "," << page_writes[i] << "\n";
+			}
+
+			for (u32 i = 0; i < 0x80; i++)
+			{
+				file << "io," << (0xFF00 + i) << "," << io_reads[i] << "," << io_writes[i] << "\n";
+			}
+
+			for (u32 i = 0; i < rom_bank_reads.size(); i++)
+			{
+				file << "rom_bank," << i << "," << rom_bank_reads[i] << ",0\n";
+			}
+		}
+
+		void dump_json_counts(std::ofstream& file, const char* name, const u64* reads, const u64* writes, u32 count, u32 base)
+		{
+			file << "  \"" << name << "\": [";
+
+			for (u32 i = 0; i < count; i++)
+			{
+				file << (i > 0 ? ", " : "") << "{ \"index\": " << (base + i) << ", \"reads\": " << reads[i] << ", \"writes\": " << (writes ? writes[i] : 0) << " }";
+			}
+
+			file << "]";
+		}
+
+		void dump_json(std::ofstream& file)
+		{
+			file << "{\n";
+			dump_json_counts(file, "pages", page_reads, page_writes, 0x100, 0);
+			file << ",\n";
+			dump_json_counts(file, "io", io_reads, io_writes, 0x80, 0xFF00);
+			file << ",\n";
+			dump_json_counts(file, "rom_banks", rom_bank_reads.data(), nullptr, (u32)rom_bank_reads.size(), 0);
+			file << "\n}\n";
+		}
+
+		// json if the file name ends in .json, otherwise csv
+		void dump(const std::string& filename)
+		{
+			std::ofstream file(filename);
+			if (!file.is_open())
+			{
+				printf("Error - could not write memory stats: %s\n", filename.c_str());
+				return;
+			}
+
+			size_t ext = filename.rfind(".");
+			if (ext != std::string::npos && filename.compare(ext, std::string::npos, ".json") == 0)
+			{
+				dump_json(file);
+			}
+			else
+			{
+				dump_csv(file);
+			}
+		}
+
+		struct dump_on_exit
+		{
+			~dump_on_exit()
+			{
+				if (!dump_filename.empty())
+				{
+					dump(dump_filename);
+				}
+			}
+		} dump_on_exit_instance;
+	}
+}
\ No newline at end of file
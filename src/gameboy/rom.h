@@ -4,6 +4,10 @@
 
 #include "mbc.h"
 #include "mbc_mbc1.h"
+#include "mbc_mbc2.h"
+#include "mbc_mbc3.h"
+#include "mbc_mbc5.h"
+#include "rom_cache.h"
 
 namespace gameboy
 {
@@ -22,30 +26,26 @@ namespace gameboy
 		};
 
 
-		u8* romdata;
+		u8* romdata; // read only mapping shared with other instances of the same rom
 		u64 romsize;
 		std::string filename;
 		rom_header romheader;
+		rom_cache::image* image;
 
 		void open(const char* path)
 		{
 			filename = path;
 
-			FILE* file = 0;
-			fopen_s(&file, filename.c_str(), "rb");
-
-			// get size
-			fseek(file, 0, SEEK_END);
-			romsize = ftell(file);
-			fseek(file, 0, SEEK_SET);
-
-			// read header
-			romdata = new u8[romsize];
-			size_t size = fread(romdata, 1, romsize, file);
-
-			assert(size == romsize);
+			image = rom_cache::acquire(filename);
+			if (image == nullptr || image->size < 0x150)
+			{
+				printf("Error - could not open rom file: %s\n", path);
+				assert(0);
+				return;
+			}
 
-			fclose(file);
+			romdata = image->data;
+			romsize = image->size;
 
 			// copy to header for reference. header starts at 0x100 of the ROM
 			memset(&romheader, 0x0, sizeof(rom_header));
@@ -58,21 +58,45 @@ namespace gameboy
 			romheader.version = romdata[0x14C];
 			romheader.cgbFlag = romdata[0x143];
 
-			switch (romheader.cartridgeType)
+			mbc::controller = get_controller(romheader.cartridgeType);
+		}
+
+		static mbc_base* get_controller(CATRIDGE_TYPE type)
+		{
+			static mbc_mbc1 mbc1;
+			static mbc_mbc2 mbc2;
+			static mbc_mbc3 mbc3;
+			static mbc_mbc5 mbc5;
+
+			switch (type)
 			{
 			case ROM_ONLY:
-				break;
+			case ROM_RAM:
+			case ROM_RAM_BATTERY:
+				return &mbc::rom_only;
 			case ROM_MBC1:
 			case ROM_MBC1_RAM:
 			case ROM_MBC1_RAM_BATTERY:
-				mbc::mbc_initialize = &mbc_mbc1::initialize;
-				mbc::mbc_get_rom_bank_idx = &mbc_mbc1::get_rom_bank_idx;
-				mbc::mbc_reset = &mbc_mbc1::reset;
-				mbc::mbc_write_memory = &mbc_mbc1::write_memory;
-				break;
+				return &mbc1;
+			case ROM_MBC2:
+			case ROM_MBC2_BATTERY:
+				return &mbc2;
+			case ROM_MBC3_TIMER_BATTERY:
+			case ROM_MBC3_TIMER_RAM_BATTERY:
+			case ROM_MBC3:
+			case ROM_MBC3_RAM:
+			case ROM_MBC3_RAM_BATTERY:
+				return &mbc3;
+			case ROM_MBC5:
+			case ROM_MBC5_RAM:
+			case ROM_MBC5_RAM_BATTERY:
+			case ROM_MBC5_RUMBLE:
+			case ROM_MBC5_RUMBLE_RAM:
+			case ROM_MBC5_RUMBLE_RAM_BATTERY:
+				return &mbc5;
 			default:
 				warning_assert("memory bank controller not supported yet");
-				break;
+				return &mbc::rom_only;
 			}
 		}
 
@@ -81,19 +105,20 @@ namespace gameboy
 			filename = "";
 			romsize = 0x0;
 			romdata = nullptr;
+			image = nullptr;
 			memset(&romheader, 0x0, sizeof(rom_header));
 		}
 
-		rom(const char* path)
+		rom(const char* path) : rom()
 		{
 			open(path);
 		}
 
 		~rom()
 		{
-			if (romdata)
+			if (image)
 			{
-				delete[] romdata;
+				rom_cache::release(image);
 			}
 		}
 	};
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "defines.h"
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// rom files are mapped read only and shared by every emulator instance in the process. images are looked up by
+// path first and then by a content key built from the cartridge header, so the same cartridge opened through
+// different paths still maps once. only the header of a new file is read until the cpu runs, unless the header
+// matches an image already mapped. a path found by content is remembered, so it is only compared once
+
+namespace gameboy
+{
+	namespace rom_cache
+	{
+		struct image
+		{
+			std::string path;
+			std::vector<std::string> alias_paths; // other paths the same contents were opened through
+			u8* data; // read only
+			u64 size;
+			u64 content_key;
+			u32 ref_count;
+#ifdef _WIN32
+			HANDLE file;
+			HANDLE mapping;
+#endif
+		};
+
+		std::mutex cache_mutex;
+		std::map<std::string, image*> images_by_path;
+		std::map<u64, image*> images_by_content;
+
+		// header checksum, global checksum, cartridge type, title and size. reads 0x134 - 0x14F only
+		u64 get_content_key(const u8* data, u64 size)
+		{
+			u64 key = 0xCBF29CE484222325ull; // fnv-1a
+
+			if (size >= 0x150)
+			{
+				for (u32 i = 0x134; i < 0x150; i++)
+				{
+					key = (key ^ data[i]) * 0x100000001B3ull;
+				}
+			}
+
+			for (u32 i = 0; i < 8; i++)
+			{
+				key = (key ^ ((size >> (i * 8)) & 0xFF)) * 0x100000001B3ull;
+			}
+
+			return key;
+		}
+
+		bool map_file(image* new_image)
+		{
+#ifdef _WIN32
+			new_image->file = CreateFileA(new_image->path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (new_image->file == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+
+			LARGE_INTEGER file_size;
+			GetFileSizeEx(new_image->file, &file_size);
+			new_image->size = (u64)file_size.QuadPart;
+
+			new_image->mapping = CreateFileMappingA(new_image->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			new_image->data = (new_image->mapping ? (u8*)MapViewOfFile(new_image->mapping, FILE_MAP_READ, 0, 0, 0) : nullptr);
+
+			if (new_image->data == nullptr)
+			{
+				if (new_image->mapping)
+				{
+					CloseHandle(new_image->mapping);
+				}
+
+				CloseHandle(new_image->file);
+				return false;
+			}
+#else
+			int file = open(new_image->path.c_str(), O_RDONLY);
+			if (file < 0)
+			{
+				return false;
+			}
+
+			struct stat file_stat;
+			if (fstat(file, &file_stat) != 0 || file_stat.st_size == 0)
+			{
+				close(file);
+				return false;
+			}
+
+			new_image->size = (u64)file_stat.st_size;
+
+			void* ptr = mmap(nullptr, (size_t)new_image->size, PROT_READ, MAP_SHARED, file, 0);
+			close(file); // the mapping keeps the file open
+
+			if (ptr == MAP_FAILED)
+			{
+				return false;
+			}
+
+			new_image->data = (u8*)ptr;
+#endif
+			return true;
+		}
+
+		void unmap_file(image* old_image)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(old_image->data);
+			CloseHandle(old_image->mapping);
+			CloseHandle(old_image->file);
+#else
+			munmap(old_image->data, (size_t)old_image->size);
+#endif
+		}
+
+		// mapped image of the file at path. null if it can not be opened
+		image* acquire(const std::string& path)
+		{
+			std::lock_guard<std::mutex> lock(cache_mutex);
+
+			auto path_itr = images_by_path.find(path);
+			if (path_itr != images_by_path.end())
+			{
+				path_itr->second->ref_count++;
+				return path_itr->second;
+			}
+
+			image* new_image = new image();
+			new_image->path = path;
+
+			if (!map_file(new_image))
+			{
+				delete new_image;
+				return nullptr;
+			}
+
+			new_image->content_key = get_content_key(new_image->data, new_image->size);
+
+			// same cartridge under another path. share the existing mapping. headers can match on patched roms so the
+			// contents are compared once here
+			auto content_itr = images_by_content.find(new_image->content_key);
+			if (content_itr != images_by_content.end() && content_itr->second->size == new_image->size &&
+				memcmp(content_itr->second->data, new_image->data, (size_t)new_image->size) == 0)
+			{
+				unmap_file(new_image);
+				delete new_image;
+
+				image* found_image = content_itr->second;
+				found_image->alias_paths.push_back(path);
+				images_by_path[path] = found_image;
+
+				found_image->ref_count++;
+				return found_image;
+			}
+
+			new_image->ref_count = 1;
+			images_by_path[path] = new_image;
+			images_by_content.insert({ new_image->content_key, new_image }); // first image keeps a shared key
+
+			return new_image;
+		}
+
+		void release(image* old_image)
+		{
+			std::lock_guard<std::mutex> lock(cache_mutex);
+
+			if (--old_image->ref_count > 0)
+			{
+				return;
+			}
+
+			images_by_path.erase(old_image->path);
+
+			for (const std::string& alias_path : old_image->alias_paths)
+			{
+				images_by_path.erase(alias_path);
+			}
+
+			auto content_itr = images_by_content.find(old_image->content_key);
+			if (content_itr != images_by_content.end() && content_itr->second == old_image)
+			{
+				images_by_content.erase(content_itr);
+			}
+
+			unmap_file(old_image);
+			delete old_image;
+		}
+	}
+}
\ No newline at end of file
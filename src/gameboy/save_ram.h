@@ -0,0 +1,254 @@
+#pragma once
+
+#include "defines.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// battery backed cartridge ram lives in a .sav file next to the rom. the file is mapped shared, so the cpu writes
+// straight into it through the page table. while the ram is clean its pages are kept off the write fast path, so
+// the first write marks it dirty. a worker thread flushes the mapping to disk at most once per sync interval,
+// so saving never waits on the disk inside a frame
+
+namespace gameboy
+{
+	namespace memory_module
+	{
+		extern void update_page_table_addr(u16 addr);
+	}
+
+	namespace save_ram
+	{
+		const u32 sync_interval_ms = 1000;
+
+		std::string filename; // .sav file. empty if the cartridge has no battery
+		u8* data = nullptr;
+		u32 size = 0;
+
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+#endif
+
+		bool dirty = false; // written since the last sync
+		bool watch_writes = false; // ram pages take the write slow path until the next write
+		std::chrono::steady_clock::time_point sync_time; // last sync handed to the thread
+
+		std::thread sync_thread;
+		std::mutex sync_mutex;
+		std::condition_variable sync_condition;
+		bool sync_requested = false;
+		bool sync_thread_stop = false;
+
+		void set_rom_filename(const std::string& rom_filename, bool has_battery)
+		{
+			if (!has_battery)
+			{
+				filename = "";
+				return;
+			}
+
+			filename = rom_filename.substr(0, rom_filename.rfind("."));
+			filename.append(".sav");
+		}
+
+		inline bool has_battery()
+		{
+			return !filename.empty();
+		}
+
+		void sync()
+		{
+#ifdef _WIN32
+			FlushViewOfFile(data, size);
+#else
+			msync(data, size, MS_SYNC);
+#endif
+		}
+
+		void sync_thread_func()
+		{
+			std::unique_lock<std::mutex> lock(sync_mutex);
+
+			while (!sync_thread_stop)
+			{
+				sync_condition.wait(lock, [] { return sync_requested || sync_thread_stop; });
+
+				if (sync_requested)
+				{
+					sync_requested = false;
+					lock.unlock();
+					sync();
+					lock.lock();
+				}
+			}
+		}
+
+		// a write to the external ram. the first one after a sync puts the pages back on the fast path
+		inline void ram_written()
+		{
+			if (watch_writes)
+			{
+				watch_writes = false;
+				dirty = true;
+				memory_module::update_page_table_addr(0xA000);
+			}
+		}
+
+		// called once a frame. a dirty ram is handed to the sync thread once the sync interval has passed
+		void update()
+		{
+			if (!dirty)
+			{
+				return;
+			}
+
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (now - sync_time < std::chrono::milliseconds(sync_interval_ms))
+			{
+				return;
+			}
+
+			// writes from here on dirty the ram again and go to the next sync
+			dirty = false;
+			watch_writes = true;
+			memory_module::update_page_table_addr(0xA000);
+			sync_time = now;
+
+			{
+				std::lock_guard<std::mutex> lock(sync_mutex);
+				sync_requested = true;
+			}
+
+			sync_condition.notify_one();
+		}
+
+		// maps the .sav file, creating or growing it to size. null if it can not be mapped
+		u8* open(u32 ram_size)
+		{
+			size = ram_size;
+
+#ifdef _WIN32
+			file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+			{
+				printf("Error - could not open save file: %s\n", filename.c_str());
+				return nullptr;
+			}
+
+			// mapping a file grows it to the mapping size
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, size, nullptr);
+			data = (mapping ? (u8*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size) : nullptr);
+
+			if (data == nullptr)
+			{
+				printf("Error - could not map save file: %s\n", filename.c_str());
+
+				if (mapping)
+				{
+					CloseHandle(mapping);
+					mapping = nullptr;
+				}
+
+				CloseHandle(file);
+				file = INVALID_HANDLE_VALUE;
+				return nullptr;
+			}
+#else
+			int file = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+			if (file < 0)
+			{
+				printf("Error - could not open save file: %s\n", filename.c_str());
+				return nullptr;
+			}
+
+			struct stat file_stat;
+			if (fstat(file, &file_stat) != 0 || (file_stat.st_size < (off_t)size && ftruncate(file, size) != 0))
+			{
+				printf("Error - could not size save file: %s\n", filename.c_str());
+				::close(file);
+				return nullptr;
+			}
+
+			void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+			::close(file); // the mapping keeps the file open
+
+			if (ptr == MAP_FAILED)
+			{
+				printf("Error - could not map save file: %s\n", filename.c_str());
+				return nullptr;
+			}
+
+			data = (u8*)ptr;
+#endif
+
+			dirty = false;
+			watch_writes = true;
+			sync_time = std::chrono::steady_clock::now();
+			sync_requested = false;
+			sync_thread_stop = false;
+			sync_thread = std::thread(sync_thread_func);
+
+			return data;
+		}
+
+		void close()
+		{
+			if (data == nullptr)
+			{
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(sync_mutex);
+				sync_thread_stop = true;
+			}
+
+			sync_condition.notify_one();
+			sync_thread.join();
+
+			sync();
+			dirty = false;
+			watch_writes = false;
+
+#ifdef _WIN32
+			UnmapViewOfFile(data);
+			CloseHandle(mapping);
+			CloseHandle(file);
+			mapping = nullptr;
+			file = INVALID_HANDLE_VALUE;
+#else
+			munmap(data, size);
+#endif
+
+			data = nullptr;
+			size = 0;
+		}
+
+		// flush the save when the process exits without a reset
+		struct close_on_exit
+		{
+			~close_on_exit()
+			{
+				close();
+			}
+		} close_on_exit_instance;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,309 @@
+#pragma once
+
+#include "defines.h"
+
+#include <chrono>
+
+// scanline pixel kernels. expand 2bpp tile rows to palette indices, look the indices up in a palette register to
+// get shades, merge sprite rows into the line's sprite pixels, composite the sprite pixels over the background with
+// transparency and priority masks and turn shades into framebuffer pixels. sse2 is the baseline on x64. avx2 is used
+// when the compiler targets it (/arch:AVX2, -mavx2).
+// every kernel has a scalar version that is used on other targets and by the kernel benchmark
+
+// use the scalar kernels even when simd is available
+//#define SCANLINE_SCALAR
+
+#if !defined(SCANLINE_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SCANLINE_SSE2
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#define SCANLINE_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+namespace gameboy
+{
+	namespace scanline_kernels
+	{
+		// 0xRRGGBBAA color to the rgba bytes of a framebuffer pixel
+		inline u32 get_pixel(u32 color)
+		{
+			u8 bytes[4] = { (u8)(color >> 24), (u8)(color >> 16), (u8)(color >> 8), 0xFF };
+			u32 pixel;
+			memcpy(&pixel, bytes, sizeof(pixel));
+			return pixel;
+		}
+
+		// scalar kernels
+
+		void expand_tile_row_scalar(u8 dataA, u8 dataB, u8* indices)
+		{
+			for (u32 pixel = 0; pixel < 8; pixel++)
+			{
+				u8 bit = 7 - pixel; // the bits and pixels are inversed
+				indices[pixel] = ((dataA >> bit) & 0x1) | (((dataB >> bit) & 0x1) << 1);
+			}
+		}
+
+		// palette register lookup. colour indices to the 0 - 3 shades of the indexed framebuffer
+		void apply_shades_scalar(u8* dst, const u8* indices, u32 count, const u8* shades)
+		{
+			for (u32 i = 0; i < count; i++)
+			{
+				dst[i] = shades[indices[i]];
+			}
+		}
+
+		// 8 sprite pixels into the line's sprite pixels. index 0 is transparent. sprites merge in priority order, so a
+		// pixel already taken by a sprite is kept
+		void merge_sprite_row_scalar(u8* obj_indices, u8* obj_shades, u8* obj_behind, const u8* indices, const u8* shades, bool behind_bg)
+		{
+			for (u32 i = 0; i < 8; i++)
+			{
+				if (obj_indices[i] == 0x0 && indices[i] != 0x0)
+				{
+					obj_indices[i] = indices[i];
+					obj_shades[i] = shades[indices[i]];
+					obj_behind[i] = (behind_bg ? 0xFF : 0x0);
+				}
+			}
+		}
+
+		// sprite pixels over the line. a sprite behind the background only shows over background index 0
+		void composite_sprites_scalar(u8* dst, const u8* bg_indices, const u8* obj_indices, const u8* obj_shades, const u8* obj_behind, u32 count)
+		{
+			for (u32 i = 0; i < count; i++)
+			{
+				if (obj_indices[i] != 0x0 && (obj_behind[i] == 0x0 || bg_indices[i] == 0x0))
+				{
+					dst[i] = obj_shades[i];
+				}
+			}
+		}
+
+		// shades to rgba framebuffer pixels
+		void apply_palette_scalar(u8* dst, const u8* shades, u32 count, const u32* pixels)
+		{
+			for (u32 i = 0; i < count; i++)
+			{
+				memcpy(&dst[i * 4], &pixels[shades[i]], sizeof(u32));
+			}
+		}
+
+#ifdef SCANLINE_SSE2
+		// simd kernels
+
+		void expand_tile_row_simd(u8 dataA, u8 dataB, u8* indices)
+		{
+			// one byte per pixel, then test the pixel's bit in each plane
+			const __m128i bits = _mm_setr_epi8((char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, 0, 0, 0, 0, 0, 0, 0, 0);
+			__m128i a = _mm_and_si128(_mm_set1_epi8((char)dataA), bits);
+			__m128i b = _mm_and_si128(_mm_set1_epi8((char)dataB), bits);
+			__m128i low = _mm_and_si128(_mm_cmpeq_epi8(a, bits), _mm_set1_epi8(0x1));
+			__m128i high = _mm_and_si128(_mm_cmpeq_epi8(b, bits), _mm_set1_epi8(0x2));
+			_mm_storel_epi64((__m128i*)indices, _mm_or_si128(low, high));
+		}
+
+#ifdef SCANLINE_AVX2
+		// shade lookup of 16 indices with a byte shuffle. avx2 targets always have ssse3
+		inline __m128i lookup_shades(__m128i indices, const u8* shades)
+		{
+			__m128i table = _mm_setr_epi8(shades[0], shades[1], shades[2], shades[3], 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+			return _mm_shuffle_epi8(table, indices);
+		}
+
+		// pixel lookup of 8 shades with a lane shuffle
+		inline __m256i lookup_pixels(__m128i shades8, __m256i palette)
+		{
+			return _mm256_permutevar8x32_epi32(palette, _mm256_cvtepu8_epi32(shades8));
+		}
+
+		void apply_palette_simd(u8* dst, const u8* shades, u32 count, const u32* pixels)
+		{
+			__m256i palette = _mm256_setr_epi32(pixels[0], pixels[1], pixels[2], pixels[3], pixels[0], pixels[1], pixels[2], pixels[3]);
+
+			u32 i = 0;
+			for (; i + 16 <= count; i += 16)
+			{
+				__m128i shade = _mm_loadu_si128((const __m128i*)&shades[i]);
+				_mm256_storeu_si256((__m256i*)&dst[i * 4], lookup_pixels(shade, palette));
+				_mm256_storeu_si256((__m256i*)&dst[(i + 8) * 4], lookup_pixels(_mm_srli_si128(shade, 8), palette));
+			}
+
+			apply_palette_scalar(&dst[i * 4], &shades[i], count - i, pixels);
+		}
+#else
+		// shade lookup of 16 indices. one compare mask per palette entry
+		inline __m128i lookup_shades(__m128i indices, const u8* shades)
+		{
+			__m128i result = _mm_and_si128(_mm_cmpeq_epi8(indices, _mm_setzero_si128()), _mm_set1_epi8((char)shades[0]));
+			result = _mm_or_si128(result, _mm_and_si128(_mm_cmpeq_epi8(indices, _mm_set1_epi8(1)), _mm_set1_epi8((char)shades[1])));
+			result = _mm_or_si128(result, _mm_and_si128(_mm_cmpeq_epi8(indices, _mm_set1_epi8(2)), _mm_set1_epi8((char)shades[2])));
+			result = _mm_or_si128(result, _mm_and_si128(_mm_cmpeq_epi8(indices, _mm_set1_epi8(3)), _mm_set1_epi8((char)shades[3])));
+			return result;
+		}
+
+		// pixel lookup of 4 shades widened to 32 bits
+		inline __m128i lookup_pixels(__m128i shades32, const __m128i* palette)
+		{
+			__m128i result = _mm_and_si128(_mm_cmpeq_epi32(shades32, _mm_setzero_si128()), palette[0]);
+			result = _mm_or_si128(result, _mm_and_si128(_mm_cmpeq_epi32(shades32, _mm_set1_epi32(1)), palette[1]));
+			result = _mm_or_si128(result, _mm_and_si128(_mm_cmpeq_epi32(shades32, _mm_set1_epi32(2)), palette[2]));
+			result = _mm_or_si128(result, _mm_and_si128(_mm_cmpeq_epi32(shades32, _mm_set1_epi32(3)), palette[3]));
+			return result;
+		}
+
+		void apply_palette_simd(u8* dst, const u8* shades, u32 count, const u32* pixels)
+		{
+			__m128i palette[4] = { _mm_set1_epi32(pixels[0]), _mm_set1_epi32(pixels[1]), _mm_set1_epi32(pixels[2]), _mm_set1_epi32(pixels[3]) };
+			__m128i zero = _mm_setzero_si128();
+
+			u32 i = 0;
+			for (; i + 16 <= count; i += 16)
+			{
+				__m128i shade = _mm_loadu_si128((const __m128i*)&shades[i]);
+				__m128i shade16_low = _mm_unpacklo_epi8(shade, zero);
+				__m128i shade16_high = _mm_unpackhi_epi8(shade, zero);
+
+				_mm_storeu_si128((__m128i*)&dst[i * 4], lookup_pixels(_mm_unpacklo_epi16(shade16_low, zero), palette));
+				_mm_storeu_si128((__m128i*)&dst[(i + 4) * 4], lookup_pixels(_mm_unpackhi_epi16(shade16_low, zero), palette));
+				_mm_storeu_si128((__m128i*)&dst[(i + 8) * 4], lookup_pixels(_mm_unpacklo_epi16(shade16_high, zero), palette));
+				_mm_storeu_si128((__m128i*)&dst[(i + 12) * 4], lookup_pixels(_mm_unpackhi_epi16(shade16_high, zero), palette));
+			}
+
+			apply_palette_scalar(&dst[i * 4], &shades[i], count - i, pixels);
+		}
+#endif
+
+		void apply_shades_simd(u8* dst, const u8* indices, u32 count, const u8* shades)
+		{
+			u32 i = 0;
+			for (; i + 16 <= count; i += 16)
+			{
+				_mm_storeu_si128((__m128i*)&dst[i], lookup_shades(_mm_loadu_si128((const __m128i*)&indices[i]), shades));
+			}
+
+			apply_shades_scalar(&dst[i], &indices[i], count - i, shades);
+		}
+
+		inline __m128i select_bytes(__m128i mask, __m128i a, __m128i b)
+		{
+			return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+		}
+
+		void merge_sprite_row_simd(u8* obj_indices, u8* obj_shades, u8* obj_behind, const u8* indices, const u8* shades, bool behind_bg)
+		{
+			__m128i idx = _mm_loadl_epi64((const __m128i*)indices);
+			__m128i old_indices = _mm_loadl_epi64((const __m128i*)obj_indices);
+			__m128i zero = _mm_setzero_si128();
+
+			// byte mask of the opaque pixels no sprite has taken yet
+			__m128i take = _mm_andnot_si128(_mm_cmpeq_epi8(idx, zero), _mm_cmpeq_epi8(old_indices, zero));
+
+			_mm_storel_epi64((__m128i*)obj_indices, select_bytes(take, idx, old_indices));
+			_mm_storel_epi64((__m128i*)obj_shades, select_bytes(take, lookup_shades(idx, shades), _mm_loadl_epi64((const __m128i*)obj_shades)));
+			_mm_storel_epi64((__m128i*)obj_behind, select_bytes(take, _mm_set1_epi8(behind_bg ? -1 : 0), _mm_loadl_epi64((const __m128i*)obj_behind)));
+		}
+
+		void composite_sprites_simd(u8* dst, const u8* bg_indices, const u8* obj_indices, const u8* obj_shades, const u8* obj_behind, u32 count)
+		{
+			__m128i zero = _mm_setzero_si128();
+
+			u32 i = 0;
+			for (; i + 16 <= count; i += 16)
+			{
+				__m128i idx = _mm_loadu_si128((const __m128i*)&obj_indices[i]);
+				__m128i behind = _mm_loadu_si128((const __m128i*)&obj_behind[i]);
+				__m128i bg = _mm_loadu_si128((const __m128i*)&bg_indices[i]);
+
+				// byte mask of the sprite pixels that show
+				__m128i show = _mm_andnot_si128(_mm_cmpeq_epi8(idx, zero), _mm_or_si128(_mm_cmpeq_epi8(behind, zero), _mm_cmpeq_epi8(bg, zero)));
+
+				__m128i old_shades = _mm_loadu_si128((const __m128i*)&dst[i]);
+				_mm_storeu_si128((__m128i*)&dst[i], select_bytes(show, _mm_loadu_si128((const __m128i*)&obj_shades[i]), old_shades));
+			}
+
+			composite_sprites_scalar(&dst[i], &bg_indices[i], &obj_indices[i], &obj_shades[i], &obj_behind[i], count - i);
+		}
+
+		inline void expand_tile_row(u8 dataA, u8 dataB, u8* indices) { expand_tile_row_simd(dataA, dataB, indices); }
+		inline void apply_shades(u8* dst, const u8* indices, u32 count, const u8* shades) { apply_shades_simd(dst, indices, count, shades); }
+		inline void merge_sprite_row(u8* obj_indices, u8* obj_shades, u8* obj_behind, const u8* indices, const u8* shades, bool behind_bg) { merge_sprite_row_simd(obj_indices, obj_shades, obj_behind, indices, shades, behind_bg); }
+		inline void composite_sprites(u8* dst, const u8* bg_indices, const u8* obj_indices, const u8* obj_shades, const u8* obj_behind, u32 count) { composite_sprites_simd(dst, bg_indices, obj_indices, obj_shades, obj_behind, count); }
+		inline void apply_palette(u8* dst, const u8* shades, u32 count, const u32* pixels) { apply_palette_simd(dst, shades, count, pixels); }
+#else
+		inline void expand_tile_row(u8 dataA, u8 dataB, u8* indices) { expand_tile_row_scalar(dataA, dataB, indices); }
+		inline void apply_shades(u8* dst, const u8* indices, u32 count, const u8* shades) { apply_shades_scalar(dst, indices, count, shades); }
+		inline void merge_sprite_row(u8* obj_indices, u8* obj_shades, u8* obj_behind, const u8* indices, const u8* shades, bool behind_bg) { merge_sprite_row_scalar(obj_indices, obj_shades, obj_behind, indices, shades, behind_bg); }
+		inline void composite_sprites(u8* dst, const u8* bg_indices, const u8* obj_indices, const u8* obj_shades, const u8* obj_behind, u32 count) { composite_sprites_scalar(dst, bg_indices, obj_indices, obj_shades, obj_behind, count); }
+		inline void apply_palette(u8* dst, const u8* shades, u32 count, const u32* pixels) { apply_palette_scalar(dst, shades, count, pixels); }
+#endif
+
+		// time a line of background and 10 sprites through the scalar and simd kernels, then the shades to pixels pass
+		// the frame does once per line. checks both give the same pixels
+		template <typename expand_func, typename shades_func, typename merge_func, typename composite_func, typename palette_func>
+		double time_kernels(u32 lines, u8* dst, const u8* indices, const u8* shades, const u32* pixels, expand_func expand, shades_func apply_shades, merge_func merge, composite_func composite, palette_func apply_palette)
+		{
+			auto start_time = std::chrono::high_resolution_clock::now();
+
+			u8 row[8];
+			u8 line_shades[160];
+			u8 obj_indices[176];
+			u8 obj_shades[176];
+			u8 obj_behind[176];
+
+			for (u32 line = 0; line < lines; line++)
+			{
+				expand((u8)line, (u8)(line >> 3), row);
+				apply_shades(line_shades, &indices[line & 0xFF], 160, shades);
+
+				memset(obj_indices, 0x0, sizeof(obj_indices));
+				for (u32 sprite = 0; sprite < 10; sprite++)
+				{
+					u32 x = (line + sprite * 13) % 168;
+					merge(&obj_indices[x], &obj_shades[x], &obj_behind[x], row, shades, (sprite & 0x1) != 0);
+				}
+
+				composite(line_shades, &indices[line & 0xFF], &obj_indices[8], &obj_shades[8], &obj_behind[8], 160);
+				apply_palette(dst, line_shades, 160, pixels);
+			}
+
+			std::chrono::duration<double, std::milli> delta = std::chrono::high_resolution_clock::now() - start_time;
+			return delta.count();
+		}
+
+		int run_benchmark(u32 lines)
+		{
+			u8 indices[0x100 + 160];
+			for (u32 i = 0; i < sizeof(indices); i++)
+			{
+				indices[i] = (u8)((i * 7 + (i >> 3)) & 0x3);
+			}
+
+			u8 shades[4] = { 0x0, 0x2, 0x1, 0x3 };
+			u32 pixels[4] = { get_pixel(0xE0F8D0FF), get_pixel(0x88C070FF), get_pixel(0x346856FF), get_pixel(0x081820FF) };
+			u8 scalar_dst[160 * 4];
+			u8 simd_dst[160 * 4];
+
+			double scalar_ms = time_kernels(lines, scalar_dst, indices, shades, pixels, expand_tile_row_scalar, apply_shades_scalar, merge_sprite_row_scalar, composite_sprites_scalar, apply_palette_scalar);
+			double simd_ms = time_kernels(lines, simd_dst, indices, shades, pixels, expand_tile_row, apply_shades, merge_sprite_row, composite_sprites, apply_palette);
+			bool match = (memcmp(scalar_dst, simd_dst, sizeof(scalar_dst)) == 0);
+
+#if defined(SCANLINE_AVX2)
+			const char* simd_name = "avx2";
+#elif defined(SCANLINE_SSE2)
+			const char* simd_name = "sse2";
+#else
+			const char* simd_name = "scalar";
+#endif
+
+			// 144 lines a frame at 60 frames a second is real time
+			double lines_per_ms = 144.0 * 60.0 / 1000.0;
+			printf("Lines: %u Scalar: %.2f ms (%.0fx real time) %s: %.2f ms (%.0fx real time) Match: %s\n", lines,
+				scalar_ms, lines / lines_per_ms / scalar_ms, simd_name, simd_ms, lines / lines_per_ms / simd_ms, match ? "yes" : "no");
+
+			return match ? 0 : 1;
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "defines.h"
+
+namespace gameboy
+{
+	namespace scheduler
+	{
+		enum EVENT_TYPE
+		{
+			EVENT_LCD = 0,
+			EVENT_TIMER,
+			EVENT_DMA,
+			EVENT_COUNT
+		};
+
+		const u64 event_none = ~0ull;
+
+		u64 cycles = 0; // master cycle counter. counts every cycle since reset
+		u64 next_event_cycles = event_none;
+		u64 event_cycles[EVENT_COUNT];
+
+		// handlers are called with the cycle the event was due. scheduler::cycles may already be past it
+		void(*event_handlers[EVENT_COUNT])(u64 event_cycles);
+
+		// state worked out from the cycle counter when it is read, with no event for each change. each keeps the cycle
+		// of its next change here, so code skipping cycles can bring it up to date and stop in front of the change
+		enum LAZY_TYPE
+		{
+			LAZY_LCD = 0,
+			LAZY_DIVIDER,
+			LAZY_TIMER,
+			LAZY_COUNT
+		};
+
+		u64 lazy_cycles[LAZY_COUNT];
+		void(*lazy_handlers[LAZY_COUNT])(u64 until_cycles);
+		u8 lazy_reads = 0; // LAZY_TYPE bits of the lazy state the cpu read since idle loop skipping cleared them
+
+		inline void update_next_event()
+		{
+			next_event_cycles = event_none;
+
+			for (u8 i = 0; i < EVENT_COUNT; i++)
+			{
+				if (event_cycles[i] < next_event_cycles)
+				{
+					next_event_cycles = event_cycles[i];
+				}
+			}
+		}
+
+		inline void schedule_event(EVENT_TYPE type, u64 at_cycles)
+		{
+			event_cycles[type] = at_cycles;
+			update_next_event();
+		}
+
+		inline void cancel_event(EVENT_TYPE type)
+		{
+			event_cycles[type] = event_none;
+			update_next_event();
+		}
+
+		inline bool is_event_scheduled(EVENT_TYPE type)
+		{
+			return event_cycles[type] != event_none;
+		}
+
+		inline u64 get_event_cycles(EVENT_TYPE type)
+		{
+			return event_cycles[type];
+		}
+
+		inline void set_lazy_cycles(LAZY_TYPE type, u64 at_cycles)
+		{
+			lazy_cycles[type] = at_cycles;
+		}
+
+		inline void lazy_state_read(LAZY_TYPE type)
+		{
+			lazy_reads |= (1 << type);
+		}
+
+		// the next cycle anything scheduled or the lazy state in lazy_mask changes
+		inline u64 get_next_change_cycles(u8 lazy_mask)
+		{
+			u64 next_cycles = next_event_cycles;
+
+			for (u8 i = 0; i < LAZY_COUNT; i++)
+			{
+				if ((lazy_mask & (1 << i)) && lazy_cycles[i] < next_cycles)
+				{
+					next_cycles = lazy_cycles[i];
+				}
+			}
+
+			return next_cycles;
+		}
+
+		// bring the lazy state up to the current cycle
+		void catch_up_lazy()
+		{
+			for (u8 i = 0; i < LAZY_COUNT; i++)
+			{
+				if (lazy_cycles[i] <= cycles)
+				{
+					lazy_handlers[i](cycles);
+				}
+			}
+		}
+
+		void run_events()
+		{
+			while (next_event_cycles <= cycles)
+			{
+				// find the earliest event. ties are run in event type order
+				u8 type = 0;
+				for (u8 i = 1; i < EVENT_COUNT; i++)
+				{
+					if (event_cycles[i] < event_cycles[type])
+					{
+						type = i;
+					}
+				}
+
+				u64 due_cycles = event_cycles[type];
+				event_cycles[type] = event_none;
+
+				event_handlers[type](due_cycles);
+
+				update_next_event();
+			}
+		}
+
+		inline void add_cycles(u32 count)
+		{
+			cycles += count;
+
+			if (cycles >= next_event_cycles)
+			{
+				run_events();
+			}
+		}
+
+		void set_event_handler(EVENT_TYPE type, void(*handler)(u64 event_cycles))
+		{
+			event_handlers[type] = handler;
+		}
+
+		void set_lazy_handler(LAZY_TYPE type, void(*handler)(u64 until_cycles))
+		{
+			lazy_handlers[type] = handler;
+		}
+
+		int reset()
+		{
+			cycles = 0;
+
+			for (u8 i = 0; i < EVENT_COUNT; i++)
+			{
+				event_cycles[i] = event_none;
+			}
+
+			for (u8 i = 0; i < LAZY_COUNT; i++)
+			{
+				lazy_cycles[i] = event_none;
+			}
+
+			next_event_cycles = event_none;
+			lazy_reads = 0;
+
+			return 0;
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "defines.h"
+#include "scanline_kernels.h"
+
+// the 384 tiles in the lcd's copy of vram decoded to one palette index byte per pixel, plus an x flipped copy for
+// sprites. the lcd marks a tile dirty when its copy of the tile changes and the tile is decoded again the next time
+// it is drawn
+
+namespace gameboy
+{
+	namespace tile_cache
+	{
+		const u32 tile_count = 384;
+		const u16 tile_data_end = 0x9800; // tile data is 0x8000 - 0x97FF, followed by the tile maps
+		const u8* vram = nullptr; // the lcd's copy of vram the tiles decode from
+
+		u8 tiles[tile_count][64];
+		u8 tiles_flip_x[tile_count][64];
+		bool tile_dirty[tile_count];
+
+		inline void invalidate(u16 addr)
+		{
+			tile_dirty[(addr - 0x8000) >> 4] = true;
+		}
+
+		void decode_tile(u32 tile)
+		{
+			const u8* data = &vram[tile * 16];
+
+			for (u32 row = 0; row < 8; row++)
+			{
+				u8* indices = &tiles[tile][row * 8];
+				scanline_kernels::expand_tile_row(data[row * 2], data[row * 2 + 1], indices);
+
+				for (u32 pixel = 0; pixel < 8; pixel++)
+				{
+					tiles_flip_x[tile][row * 8 + (7 - pixel)] = indices[pixel];
+				}
+			}
+
+			tile_dirty[tile] = false;
+		}
+
+		// 8 palette indices of a tile row. tile is the index into vram tile data, 0 - 383
+		inline const u8* get_row(u32 tile, u32 row, bool flip_x = false)
+		{
+			if (tile_dirty[tile])
+			{
+				decode_tile(tile);
+			}
+
+			return (flip_x ? tiles_flip_x[tile] : tiles[tile]) + row * 8;
+		}
+
+		void reset()
+		{
+			for (u32 i = 0; i < tile_count; i++)
+			{
+				tile_dirty[i] = true;
+			}
+		}
+	}
+}
\ No newline at end of file
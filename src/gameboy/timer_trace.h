@@ -0,0 +1,187 @@
+#pragma once
+
+#include "defines.h"
+
+#include "cpu.h"
+#include "memory_module.h"
+#include "scheduler.h"
+
+#include <random>
+
+// the divider and timer are worked out from the cycle counter in a few big steps. the trace runs them through random
+// register reads and writes, cycle advances and lazy catch ups next to a model that counts every cycle the way the
+// hardware does. the registers are compared on every read and the timer interrupt after every advance
+
+namespace gameboy
+{
+	namespace timer_trace
+	{
+		// counts every cycle
+		struct timer_model
+		{
+			u64 cycles;
+			u8 divider;
+			u8 value;
+			u8 modulator;
+			u8 controller;
+			s32 counter; // cycles to the next timer tick. kept while the timer is stopped
+			bool interrupt;
+
+			u32 get_frequency()
+			{
+				switch (controller & 0x3)
+				{
+				case 0x0:
+					return 1024;
+				case 0x1:
+					return 16;
+				case 0x2:
+					return 64;
+				}
+
+				return 256;
+			}
+
+			// the ticks due on the current cycle
+			void tick()
+			{
+				while ((controller & 0x4) && counter <= 0)
+				{
+					if (value == 0xFF)
+					{
+						value = modulator;
+						interrupt = true;
+					}
+					else
+					{
+						value++;
+					}
+
+					counter += get_frequency();
+				}
+			}
+
+			void advance(u32 cycle_count)
+			{
+				for (u32 i = 0; i < cycle_count; i++)
+				{
+					cycles++;
+
+					if ((cycles % 256) == 0)
+					{
+						divider++;
+					}
+
+					if (controller & 0x4)
+					{
+						counter--;
+						tick();
+					}
+				}
+			}
+
+			void write_controller(u8 new_controller)
+			{
+				if ((controller & 0x3) != (new_controller & 0x3)) // frequency changed. reset the timer
+				{
+					controller = new_controller;
+					counter = get_frequency();
+					value = modulator;
+				}
+
+				controller = new_controller;
+				tick();
+			}
+		};
+
+		bool check(const char* name, u32 step, u32 value, u32 expected)
+		{
+			if (value != expected)
+			{
+				printf("Timer trace: step %u %s is 0x%X, the model has 0x%X\n", step, name, value, expected);
+				return false;
+			}
+
+			return true;
+		}
+
+		// expects a reset cpu. returns 0 when the trace matches the model
+		int run(u32 steps)
+		{
+			std::mt19937 rng(steps);
+
+			// the timer counter is 0 after a reset
+			timer_model model;
+			model.cycles = scheduler::cycles;
+			model.divider = memory_module::read_memory(0xFF04);
+			model.value = memory_module::read_memory(0xFF05);
+			model.modulator = memory_module::read_memory(0xFF06);
+			model.controller = memory_module::read_memory(0xFF07);
+			model.counter = 0;
+			model.interrupt = cpu::get_request_interrupt_flag(cpu::INTERRUPT_TIMER) != 0;
+
+			bool match = true;
+			for (u32 step = 0; step < steps && match; step++)
+			{
+				u32 op = rng() % 100;
+
+				if (op < 40)
+				{
+					// mostly instruction sized steps. now and then a halt or idle loop sized one
+					u32 cycle_count = ((rng() % 8) == 0 ? rng() % 5000 : (rng() % 6) * 4 + 4);
+					scheduler::add_cycles(cycle_count);
+					model.advance(cycle_count);
+
+					match = check("timer interrupt", step, cpu::get_request_interrupt_flag(cpu::INTERRUPT_TIMER), model.interrupt);
+				}
+				else if (op < 55)
+				{
+					match = check("tima", step, memory_module::read_memory(0xFF05), model.value);
+				}
+				else if (op < 65)
+				{
+					match = check("div", step, memory_module::read_memory(0xFF04), model.divider);
+				}
+				else if (op < 70)
+				{
+					// close to an overflow now and then
+					u8 value = (u8)((rng() % 8) == 0 ? 0xF0 + rng() % 16 : rng());
+					memory_module::write_memory(0xFF05, value);
+					model.value = value;
+				}
+				else if (op < 74)
+				{
+					// a modulator close to 0xFF overflows every few ticks
+					u8 value = (u8)((rng() % 4) == 0 ? 0xFF - rng() % 3 : rng());
+					memory_module::write_memory(0xFF06, value);
+					model.modulator = value;
+				}
+				else if (op < 79)
+				{
+					u8 value = (u8)(rng() % 8);
+					memory_module::write_memory(0xFF07, value);
+					model.write_controller(value);
+				}
+				else if (op < 82)
+				{
+					memory_module::write_memory(0xFF04, (u8)rng());
+					model.divider = 0;
+				}
+				else if (op < 90)
+				{
+					cpu::clear_request_interrupt_flag(cpu::INTERRUPT_TIMER);
+					model.interrupt = false;
+				}
+				else
+				{
+					// what idle loop skipping does before it skips
+					scheduler::catch_up_lazy();
+				}
+			}
+
+			printf("Timer trace: %u steps %llu cycles Match: %s\n", steps, (unsigned long long)scheduler::cycles, match ? "yes" : "no");
+
+			return match ? 0 : 1;
+		}
+	}
+}
\ No newline at end of file